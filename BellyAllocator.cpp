@@ -0,0 +1,182 @@
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "SlabAllocator.h"
+#include "BellyAllocator.h"
+#include "QueryLimits.h"
+
+static const size_t CHUNK_HEADER_SIZE = 32;
+
+// The arena in effect on this thread, if any.
+static thread_local RequestArena *currentArena = 0;
+
+// -----------------------------------------------------------------------------
+
+RequestArena::RequestArena(size_t chunkSize) :
+    chunkSize(chunkSize),
+    chunks(NewChunk(chunkSize)),
+    limits(0)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+RequestArena::~RequestArena()
+{
+    while(chunks)
+    {
+        Chunk *next = chunks->next;
+        std::free(chunks);
+        chunks = next;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+RequestArena::Chunk *RequestArena::NewChunk(size_t capacity)
+{
+    Chunk *chunk = static_cast<Chunk*>(std::malloc(CHUNK_HEADER_SIZE + capacity));
+    if(!chunk)
+        throw std::bad_alloc();
+    chunk->next     = 0;
+    chunk->capacity = capacity;
+    chunk->used     = 0;
+    return chunk;
+}
+
+// -----------------------------------------------------------------------------
+
+void *RequestArena::Allocate(size_t size)
+{
+    if(limits)
+        limits->Spend(1);
+
+    size_t total = SlabHeap::HEADER_SIZE + ((size + 7) & ~size_t(7));
+    if(chunks->used + total > chunks->capacity)
+    {
+        Chunk *chunk = NewChunk(total > chunkSize ? total : chunkSize);
+        chunk->next = chunks;
+        chunks = chunk;
+    }
+
+    char *block = reinterpret_cast<char*>(chunks) + CHUNK_HEADER_SIZE + chunks->used;
+    chunks->used += total;
+
+    uint32_t *header = reinterpret_cast<uint32_t*>(block);
+    header[0] = ARENA_BLOCK;
+    header[1] = 0;
+    return block + SlabHeap::HEADER_SIZE;
+}
+
+// -----------------------------------------------------------------------------
+
+void RequestArena::Reset()
+{
+    while(chunks->next)
+    {
+        Chunk *next = chunks->next;
+        std::free(chunks);
+        chunks = next;
+    }
+    chunks->used = 0;
+}
+
+// -----------------------------------------------------------------------------
+
+ArenaScope::ArenaScope(RequestArena *arena) :
+    previous(currentArena)
+{
+    currentArena = arena;
+}
+
+// -----------------------------------------------------------------------------
+
+ArenaScope::~ArenaScope()
+{
+    currentArena = previous;
+}
+
+// -----------------------------------------------------------------------------
+
+// Every thread allocates long-lived values from a SlabHeap of its own, so
+// threads never wait on each other to allocate. A block released on another
+// thread than the one whose heap it came from is handed back to that heap,
+// which takes it back on its next allocation. Heaps outlive their threads,
+// as the document keeps their blocks: a thread that ends leaves its heap to
+// the next thread that starts allocating.
+
+static std::mutex idleHeapsMutex;
+
+static std::vector<SlabHeap*> &IdleHeaps()
+{
+    static std::vector<SlabHeap*> *idle = new std::vector<SlabHeap*>;
+    return *idle;
+}
+
+// The heap of this thread, leased on its first allocation.
+static thread_local SlabHeap *threadHeap = 0;
+
+namespace
+{
+    // Puts the heap of a thread back in the idle list when the thread ends.
+    struct HeapLease
+    {
+        ~HeapLease()
+        {
+            const std::lock_guard<std::mutex> lock(idleHeapsMutex);
+            IdleHeaps().push_back(threadHeap);
+            threadHeap = 0;
+        }
+    };
+}
+
+// -----------------------------------------------------------------------------
+
+static SlabHeap &ThreadHeap()
+{
+    if(!threadHeap)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(idleHeapsMutex);
+            if(IdleHeaps().empty())
+                threadHeap = new SlabHeap;
+            else
+            {
+                threadHeap = IdleHeaps().back();
+                IdleHeaps().pop_back();
+            }
+        }
+        static thread_local HeapLease lease;
+    }
+    return *threadHeap;
+}
+
+// -----------------------------------------------------------------------------
+
+void *BellyAllocate(size_t size)
+{
+    if(currentArena)
+        return currentArena->Allocate(size);
+
+    SlabHeap &heap = ThreadHeap();
+    void *ptr = heap.Allocate(size);
+    if(!ptr && size == 0)
+        ptr = heap.Allocate(1);
+    return ptr;
+}
+
+// -----------------------------------------------------------------------------
+
+void BellyDeallocate(void *ptr)
+{
+    if(!ptr || SlabHeap::BlockKind(ptr) == RequestArena::ARENA_BLOCK)
+        return;
+
+    SlabHeap *owner = SlabHeap::OwnerOf(ptr);
+    if(owner == threadHeap)
+        owner->Deallocate(ptr);
+    else
+        owner->DeallocateRemote(ptr);
+}
@@ -0,0 +1,72 @@
+#include <algorithm>
+
+#include "PathVersions.h"
+
+// -----------------------------------------------------------------------------
+
+static bool IsPrefix(const PathVersions::Path &prefix, const PathVersions::Path &path)
+{
+    return prefix.size() <= path.size() && std::equal(prefix.begin(), prefix.end(), path.begin());
+}
+
+// -----------------------------------------------------------------------------
+
+PathVersions::PathVersions(size_t limit) :
+    current(0),
+    limit(limit)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+uint64_t PathVersions::Touch(const Path &path)
+{
+    ++current;
+
+    Path ancestor;
+    ancestor.reserve(path.size());
+    for(const std::string &token : path)
+    {
+        stamps[ancestor].subtree = current;
+        ancestor.push_back(token);
+    }
+
+    // Descendants sort right after the path itself.
+    auto below = stamps.upper_bound(path);
+    while(below != stamps.end() && IsPrefix(path, below->first))
+        below = stamps.erase(below);
+
+    Stamp &stamp = stamps[path];
+    stamp.subtree = current;
+    stamp.direct  = current;
+
+    if(stamps.size() > limit)
+    {
+        stamps.clear();
+        stamps[Path()].subtree = current;
+        stamps[Path()].direct  = current;
+    }
+    return current;
+}
+
+// -----------------------------------------------------------------------------
+
+uint64_t PathVersions::Version(const Path &path) const
+{
+    uint64_t version = 0;
+
+    auto own = stamps.find(path);
+    if(own != stamps.end())
+        version = own->second.subtree;
+
+    Path ancestor;
+    ancestor.reserve(path.size());
+    for(size_t depth = 0; depth < path.size(); ++depth)
+    {
+        auto stamp = stamps.find(ancestor);
+        if(stamp != stamps.end())
+            version = std::max(version, stamp->second.direct);
+        ancestor.push_back(path[depth]);
+    }
+    return version;
+}
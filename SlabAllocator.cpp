@@ -0,0 +1,301 @@
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "SlabAllocator.h"
+
+// Block sizes, header included: 16 byte steps up to 128, then four classes
+// per power of two up to MAX_SMALL.
+static const size_t CLASS_SIZES[] = {
+      16,   32,   48,   64,   80,   96,  112,  128,
+     160,  192,  224,  256,
+     320,  384,  448,  512,
+     640,  768,  896, 1024,
+    1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096
+};
+
+static const size_t CLASS_COUNT = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+
+// Large blocks keep their size and their heap in front of the regular header.
+static const size_t LARGE_PREFIX = 32;
+
+// -----------------------------------------------------------------------------
+
+SlabHeap::SlabHeap() :
+    freeLists(new FreeBlock*[CLASS_COUNT]()),
+    slabs(0),
+    inUse(0),
+    reserved(0),
+    remoteFrees(0)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+SlabHeap::~SlabHeap()
+{
+    while(slabs)
+    {
+        Slab *next = slabs->next;
+        std::free(slabs);
+        slabs = next;
+    }
+    delete[] freeLists;
+}
+
+// -----------------------------------------------------------------------------
+
+size_t SlabHeap::ClassSize(size_t cls)
+{
+    return CLASS_SIZES[cls];
+}
+
+// -----------------------------------------------------------------------------
+
+namespace
+{
+    // One slot per 16 byte step of block size, mapping it to its class.
+    struct ClassTable
+    {
+        unsigned char slots[SlabHeap::MAX_SMALL / 16 + 1];
+
+        ClassTable()
+        {
+            size_t cls = 0;
+            for(size_t slot = 0; slot <= SlabHeap::MAX_SMALL / 16; ++slot)
+            {
+                while(CLASS_SIZES[cls] < slot * 16)
+                    ++cls;
+                slots[slot] = (unsigned char)cls;
+            }
+        }
+    };
+}
+
+size_t SlabHeap::ClassOf(size_t size)
+{
+    // Built on first use; heaps on other threads may get here at the same time.
+    static const ClassTable table;
+    return table.slots[(size + 15) / 16];
+}
+
+// -----------------------------------------------------------------------------
+
+void SlabHeap::Refill(size_t cls)
+{
+    // Aligned to its size, so OwnerOf() finds the slab of any of its blocks.
+    Slab *slab = static_cast<Slab*>(std::aligned_alloc(SLAB_SIZE, SLAB_SIZE));
+    if(!slab)
+        throw std::bad_alloc();
+    slab->next  = slabs;
+    slab->owner = this;
+    slabs = slab;
+    reserved += SLAB_SIZE;
+
+    // The first 16 bytes hold the slab header; blocks stay 16 byte aligned.
+    size_t blockSize = ClassSize(cls);
+    char *block = reinterpret_cast<char*>(slab) + 16;
+    char *end   = reinterpret_cast<char*>(slab) + SLAB_SIZE;
+    for(; block + blockSize <= end; block += blockSize)
+    {
+        FreeBlock *free = reinterpret_cast<FreeBlock*>(block);
+        free->next = freeLists[cls];
+        freeLists[cls] = free;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void *SlabHeap::Allocate(size_t size)
+{
+    if(size == 0)
+        return 0;
+
+    if(remoteFrees.load(std::memory_order_relaxed))
+        DrainRemote();
+
+    size_t total = size + HEADER_SIZE;
+    if(total > MAX_SMALL)
+    {
+        char *raw = static_cast<char*>(std::malloc(total + LARGE_PREFIX - HEADER_SIZE));
+        if(!raw)
+            throw std::bad_alloc();
+        reinterpret_cast<size_t*>(raw)[0]    = size;
+        reinterpret_cast<SlabHeap**>(raw)[1] = this;
+        Header *header = reinterpret_cast<Header*>(raw + LARGE_PREFIX - HEADER_SIZE);
+        header->kind = LARGE_BLOCK;
+        header->cls  = 0;
+        inUse    += size;
+        reserved += size;
+        return raw + LARGE_PREFIX;
+    }
+
+    size_t cls = ClassOf(total);
+    if(!freeLists[cls])
+        Refill(cls);
+
+    FreeBlock *block = freeLists[cls];
+    freeLists[cls] = block->next;
+
+    Header *header = reinterpret_cast<Header*>(block);
+    header->kind = SMALL_BLOCK;
+    header->cls  = (uint32_t)cls;
+    inUse += ClassSize(cls) - HEADER_SIZE;
+    return reinterpret_cast<char*>(block) + HEADER_SIZE;
+}
+
+// -----------------------------------------------------------------------------
+
+void SlabHeap::Deallocate(void *ptr)
+{
+    if(!ptr)
+        return;
+
+    char *payload = static_cast<char*>(ptr);
+    Header *header = reinterpret_cast<Header*>(payload - HEADER_SIZE);
+    if(header->kind == LARGE_BLOCK)
+    {
+        char *raw = payload - LARGE_PREFIX;
+        size_t size = *reinterpret_cast<size_t*>(raw);
+        inUse    -= size;
+        reserved -= size;
+        std::free(raw);
+        return;
+    }
+
+    size_t cls = header->cls;
+    inUse -= ClassSize(cls) - HEADER_SIZE;
+    FreeBlock *block = reinterpret_cast<FreeBlock*>(header);
+    block->next = freeLists[cls];
+    freeLists[cls] = block;
+}
+
+// -----------------------------------------------------------------------------
+
+void SlabHeap::DeallocateRemote(void *ptr)
+{
+    if(!ptr)
+        return;
+
+    // Every payload has room for the link: the smallest class has 8 bytes.
+    const std::lock_guard<std::mutex> lock(remoteMutex);
+    *static_cast<void**>(ptr) = remoteFrees.load(std::memory_order_relaxed);
+    remoteFrees.store(ptr, std::memory_order_relaxed);
+}
+
+// -----------------------------------------------------------------------------
+
+void SlabHeap::DrainRemote()
+{
+    void *ptr;
+    {
+        const std::lock_guard<std::mutex> lock(remoteMutex);
+        ptr = remoteFrees.load(std::memory_order_relaxed);
+        remoteFrees.store(0, std::memory_order_relaxed);
+    }
+
+    while(ptr)
+    {
+        void *next = *static_cast<void**>(ptr);
+        Deallocate(ptr);
+        ptr = next;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+size_t SlabHeap::BlockSize(const void *ptr) const
+{
+    const char *payload = static_cast<const char*>(ptr);
+    const Header *header = reinterpret_cast<const Header*>(payload - HEADER_SIZE);
+    if(header->kind == LARGE_BLOCK)
+        return *reinterpret_cast<const size_t*>(payload - LARGE_PREFIX);
+    return ClassSize(header->cls) - HEADER_SIZE;
+}
+
+// -----------------------------------------------------------------------------
+
+void *SlabHeap::Reallocate(void *ptr, size_t newSize)
+{
+    if(!ptr)
+        return Allocate(newSize);
+
+    if(newSize == 0)
+    {
+        Deallocate(ptr);
+        return 0;
+    }
+
+    size_t oldSize = BlockSize(ptr);
+    if(newSize <= oldSize && BlockKind(ptr) == SMALL_BLOCK)
+        return ptr;
+
+    void *fresh = Allocate(newSize);
+    std::memcpy(fresh, ptr, oldSize < newSize ? oldSize : newSize);
+    Deallocate(ptr);
+    return fresh;
+}
+
+// -----------------------------------------------------------------------------
+
+uint32_t SlabHeap::BlockKind(const void *ptr)
+{
+    return reinterpret_cast<const Header*>(static_cast<const char*>(ptr) - HEADER_SIZE)->kind;
+}
+
+// -----------------------------------------------------------------------------
+
+SlabHeap *SlabHeap::OwnerOf(const void *ptr)
+{
+    const char *payload = static_cast<const char*>(ptr);
+    if(BlockKind(ptr) == LARGE_BLOCK)
+        return reinterpret_cast<SlabHeap *const*>(payload - LARGE_PREFIX)[1];
+    return reinterpret_cast<const Slab*>(reinterpret_cast<uintptr_t>(payload) & ~uintptr_t(SLAB_SIZE - 1))->owner;
+}
+
+// -----------------------------------------------------------------------------
+
+// Never destroyed: global documents may still free into it at exit.
+
+static SlabHeap &DocumentHeap()
+{
+    static SlabHeap *heap = new SlabHeap;
+    return *heap;
+}
+
+// -----------------------------------------------------------------------------
+
+void *SlabAllocator::Malloc(size_t size)
+{
+    return DocumentHeap().Allocate(size);
+}
+
+// -----------------------------------------------------------------------------
+
+void *SlabAllocator::Realloc(void *originalPtr, size_t originalSize, size_t newSize)
+{
+    (void)originalSize;
+    return DocumentHeap().Reallocate(originalPtr, newSize);
+}
+
+// -----------------------------------------------------------------------------
+
+void SlabAllocator::Free(void *ptr)
+{
+    DocumentHeap().Deallocate(ptr);
+}
+
+// -----------------------------------------------------------------------------
+
+size_t SlabAllocator::Size()
+{
+    return DocumentHeap().BytesInUse();
+}
+
+// -----------------------------------------------------------------------------
+
+size_t SlabAllocator::Capacity()
+{
+    return DocumentHeap().BytesReserved();
+}
@@ -0,0 +1,133 @@
+#include "WorkerPool.h"
+
+// -----------------------------------------------------------------------------
+
+WorkerPool::WorkerPool(size_t threads) :
+    task(0),
+    count(0),
+    next(0),
+    finished(0),
+    generation(0),
+    stopping(false)
+{
+    Resize(threads);
+}
+
+// -----------------------------------------------------------------------------
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+}
+
+// -----------------------------------------------------------------------------
+
+void WorkerPool::Resize(size_t threads)
+{
+    const std::lock_guard<std::mutex> running(runMutex);
+    Stop();
+
+    stopping = false;
+    for(size_t i = 0; i < threads; ++i)
+        workers.emplace_back(&WorkerPool::Work, this, i + 1);
+}
+
+// -----------------------------------------------------------------------------
+
+void WorkerPool::Stop()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread &worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+void WorkerPool::Run(size_t tasks, const Task &f)
+{
+    const std::lock_guard<std::mutex> running(runMutex);
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        task     = &f;
+        count    = tasks;
+        finished = 0;
+        failure  = nullptr;
+        next     = 0;
+        ++generation;
+    }
+    wake.notify_all();
+
+    Drain(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return finished == count; });
+    task = 0;
+
+    if(failure)
+        std::rethrow_exception(failure);
+}
+
+// -----------------------------------------------------------------------------
+
+// Runs tasks of the current job until none are left. Tasks are claimed under
+// the lock together with the job they belong to, so a thread that arrives
+// late can't pick up a number from the next job.
+
+void WorkerPool::Drain(size_t slot)
+{
+    for(;;)
+    {
+        const Task *f;
+        size_t i;
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if(!task || next >= count)
+                return;
+            f = task;
+            i = next++;
+        }
+
+        std::exception_ptr thrown;
+        try
+        {
+            (*f)(i, slot);
+        }
+        catch(...)
+        {
+            thrown = std::current_exception();
+        }
+
+        bool last;
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if(thrown && !failure)
+                failure = thrown;
+            last = ++finished == count;
+        }
+        if(last)
+            done.notify_all();
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void WorkerPool::Work(size_t slot)
+{
+    unsigned long seen = 0;
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || (task && generation != seen); });
+            if(stopping)
+                return;
+            seen = generation;
+        }
+        Drain(slot);
+    }
+}
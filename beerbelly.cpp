@@ -1,6 +1,9 @@
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include <cstdlib>
+#include <cerrno>
 #include <utility>
 #include <cctype>
 #include <string>
@@ -10,8 +13,18 @@
 #include <fstream>
 #include <chrono>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
 #include <iomanip>
 #include <iterator>
+#include <regex>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <limits>
 
 #include <fcgio.h>
 #include <fcgiapp.h>
@@ -25,9 +38,20 @@
 #include <jsoncons_ext/jsonpath/jsonpath.hpp>
 #include <jsoncons_ext/jmespath/jmespath.hpp>
 #include <jsoncons_ext/mergepatch/mergepatch.hpp>
+#include <jsoncons_ext/jsonpatch/jsonpatch.hpp>
 
 #include "ClockSetup.h"
 #include "base64.h"
+#include "BellyAllocator.h"
+#include "FieldIndex.h"
+#include "LruCache.h"
+#include "PathVersions.h"
+#include "ResultCache.h"
+#include "WorkerPool.h"
+#include "QueryLimits.h"
+#include "Aggregation.h"
+#include "Preconditions.h"
+#include "PartitionedQuery.h"
 
 static const std::string JSON_HEADER = 
     "Status: 200 OK\r\n"
@@ -45,7 +69,13 @@ static const std::string CLIENT_ERROR_HEADER =
 
 static const std::string INCORRECT_PATCH_MEDIA_TYPE = 
     "Status: 415 Unsupported Media\r\n"
-    "Accept-Patch: application/json, application/merge-patch+json\r\n";
+    "Accept-Patch: application/json, application/merge-patch+json, application/json-patch+json\r\n";
+
+static const std::string CONFLICT_HEADER = 
+    "Status: 409 Conflict\r\n";
+
+static const std::string NOT_MODIFIED_HEADER = 
+    "Status: 304 Not Modified\r\n";
 
 static const std::string PRECONDITION_FAILED_HEADER = 
     "Status: 412 Precondition Failed\r\n";
@@ -57,20 +87,196 @@ static const std::string METHOD_ERROR_HEADER =
 static const std::string CONTENT_DISPOSITION_HEADER = 
     "Content-disposition: inline; filename=\"hmb.json\"\r\n";
 
+static const std::string QUERY_TIMEOUT_HEADER = 
+    "Status: 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n";
+
+static const std::string QUERY_REJECTED_HEADER = 
+    "Status: 422 Unprocessable Entity\r\n";
+
 static const std::string METHOD_ERROR_BODY = 
     "{ \"error\" : \"Method Not Allowed\" }";
 
 static const std::string END_HEADERS = "\r\n";
 
+static const std::string AGGREGATE_MEDIA_TYPE = "application/aggregate+json";
+static const std::string BATCH_MEDIA_TYPE     = "application/batch+json";
+
+static const std::string ADMIN_PATH = "/_admin";
+static const std::string VIEWS_PATH = "/_views";
+
+static const size_t DEFAULT_QUERY_CACHE  = 256;
+static const size_t DEFAULT_RESULT_CACHE = 1024;
+
+static const size_t DEFAULT_PARALLEL_THRESHOLD = 100000;
+
+// Elements per slice of a partitioned query.
+static const size_t PARTITION_SIZE = 8192;
+
 static const std::string PID_FILE      = "/var/run/beerbelly-fcgi.pid";
 static const std::string FCGI_PORT     = "/var/run/beerbelly.sock";
 
+static const size_t DEFAULT_REQUEST_THREADS = 4;
+static const size_t DEFAULT_SNAPSHOT_CACHE  = 4;
+static const size_t DEFAULT_SNAPSHOT_MIN    = 1024;
+
 volatile sig_atomic_t powerSwitch = 1;
 
-time_point     lastModified;
-jsoncons::json jdoc;
+// How objects store their members, chosen at build time (see
+// BEERBELLY_OBJECT_POLICY in CMakeLists.txt). Sorted members, the default,
+// give O(log n) lookups by binary search but O(n) insertion; insertion-order
+// members append in O(1) but every lookup by name is a linear scan. Neither
+// hashes member names and there is no hashed policy, so growing an object
+// one member at a time stays quadratic. Everything below only relies on the
+// Json typedef, so any policy with jsoncons' policy interface can be dropped
+// in here.
+#ifdef BEERBELLY_ORDERED_OBJECTS
+typedef jsoncons::order_preserving_policy ObjectPolicy;
+#else
+typedef jsoncons::sorted_policy ObjectPolicy;
+#endif
+
+// Document values live in the slab heap; see BellyAllocator.h.
+typedef jsoncons::basic_json<char, ObjectPolicy, BellyAllocator<char>> Json;
+
+std::atomic<time_point> lastModified;
+Json           jdoc;
 jsoncons::json jsettings;
-std::recursive_mutex docMutex;
+
+// Requests are answered by several threads. Writers hold docMutex exclusively;
+// readers share it, and queries only long enough to pin a snapshot.
+std::shared_mutex docMutex;
+std::mutex        acceptMutex;
+std::mutex        saveMutex;
+
+// The FastCGI streams of the request being handled on this thread.
+thread_local std::istream *fcgiIn  = &std::cin;
+thread_local std::ostream *fcgiOut = &std::cout;
+thread_local std::ostream *fcgiErr = &std::cerr;
+
+// Request-scoped temporaries, reset after every request.
+thread_local RequestArena requestArena;
+
+// Secondary indexes from the "indexes" setting.
+std::vector<FieldIndex<Json>> fieldIndexes;
+
+// A JSONPath or JMESPath query compiled once and kept by its text. Equality
+// filters that an index could answer are recognized at the same time.
+typedef decltype(jsoncons::jsonpath::make_expression<Json>(std::string())) JsonPathExpression;
+typedef decltype(jsoncons::jmespath::make_expression<Json>(std::string())) JmesPathExpression;
+
+struct CompiledQuery
+{
+    std::unique_ptr<JsonPathExpression> jsonpath;
+    std::unique_ptr<JmesPathExpression> jmespath;
+
+    bool        equalityFilter = false;
+    std::string keyPointer;
+    IndexKey    key;
+};
+
+LruCache<std::string, std::shared_ptr<CompiledQuery>> queryCache(DEFAULT_QUERY_CACHE);
+std::mutex        queryCacheMutex;
+
+// A named query from the "views" setting whose result is kept, serialized,
+// and brought up to date by the writes under its source (see NoteViewWrite).
+// Element-wise queries keep their rows together with how many rows each
+// source element gave, so single elements can be added, replaced and
+// removed; aggregates take appended elements. Anything else leaves the view
+// stale, and it is recomputed when next read.
+struct MaterializedView
+{
+    enum Kind
+    {
+        ELEMENTWISE,
+        AGGREGATE,
+        QUERY
+    };
+
+    Kind                               kind = QUERY;
+    std::vector<std::string>           source;
+    std::shared_ptr<CompiledQuery>     compiled;
+    std::unique_ptr<Aggregation<Json>> aggregation;
+
+    bool                stale   = true;     // recompute from the source
+    bool                dirty   = true;     // 'body' is behind 'rows' or 'aggregation'
+    bool                tracked = false;    // the source is an array followed element by element
+    Json                rows;
+    std::vector<size_t> counts;
+
+    std::string         body;
+    std::string         etag;
+    size_t              deltas     = 0;
+    size_t              recomputes = 0;
+};
+
+// Writers update the views holding docMutex exclusively; readers, holding it
+// shared, take viewMutex too as reading may recompute or serialize.
+std::map<std::string, MaterializedView> views;
+std::mutex        viewMutex;
+
+// Queries run on a snapshot: a copy made under the shared document lock and
+// never changed afterwards, kept by path for as long as the subtree's version
+// is unchanged so that repeated and concurrent queries share it. Writers go
+// ahead while queries finish on their snapshot. Only queries of a subtree
+// with fewer than snapshotMin elements and members, at any depth, run under
+// the shared lock instead, as a copy would cost them about as much.
+struct Snapshot
+{
+    uint64_t                    version;
+    std::shared_ptr<const Json> value;
+};
+
+LruCache<std::string, Snapshot> snapshotCache(DEFAULT_SNAPSHOT_CACHE);
+std::mutex        snapshotMutex;
+size_t            snapshotMin = DEFAULT_SNAPSHOT_MIN;
+
+// Lookups rebuild stale field indexes, so readers take turns on them.
+// Writers hold docMutex exclusively and need no more.
+std::mutex        indexMutex;
+
+// Serialized query results by path and query text, valid while the version
+// of the queried subtree is unchanged. Writers bump versions while holding
+// both docMutex and resultMutex; cache hits only take resultMutex shared.
+PathVersions      pathVersions;
+ResultCache       resultCache(DEFAULT_RESULT_CACHE);
+std::shared_mutex resultMutex;
+
+// The versions also make the ETags of nodes, qualified by an epoch taken at
+// startup since they start over with every run; see VersionETag().
+uint64_t          epoch = 0;
+
+// Queries over arrays of at least parallelThreshold elements are split over
+// the worker pool when they work on each element separately. Every thread of
+// the pool, the calling one being slot 0, allocates from its own arena. The
+// arenas belong to the request thread, see PartitionArenas().
+WorkerPool        workerPool;
+size_t            parallelThreshold = DEFAULT_PARALLEL_THRESHOLD;
+thread_local std::vector<std::unique_ptr<RequestArena>> partitionArenas;
+
+// Limits on each POSTed query, all off when zero: a deadline, a budget of
+// work units and a ceiling on EstimateQueryCost checked before evaluation.
+std::chrono::milliseconds queryTimeout(0);
+uint64_t          queryBudget  = 0;
+double            maxQueryCost = 0;
+
+struct QueryMetrics
+{
+    std::atomic<size_t> evaluated{0};
+    std::atomic<size_t> rejected{0};    // by the cost pre-check
+    std::atomic<size_t> timedOut{0};
+    std::atomic<size_t> overBudget{0};
+};
+
+QueryMetrics      queryMetrics;
+
+// What a write did at its location, for keeping the field indexes in step.
+enum WriteKind
+{
+    WRITE_CHANGED,      // value replaced or modified in place
+    WRITE_INSERTED,     // element inserted into an array
+    WRITE_REMOVED       // member or element removed
+};
 
 
 // -----------------------------------------------------------------------------
@@ -100,11 +306,905 @@ bool ReadSettingsFromFile(const std::string &file)
 }
 
 
+// -----------------------------------------------------------------------------
+
+// Splits a JSON Pointer into its unescaped reference tokens.
+
+std::vector<std::string> PointerTokens(const std::string &path)
+{
+    std::vector<std::string> tokens;
+    size_t start = 1;
+    while(start <= path.size() && !path.empty())
+    {
+        size_t end = path.find('/', start);
+        if(end == std::string::npos)
+            end = path.size();
+
+        std::string token;
+        for(size_t i = start; i < end; ++i)
+        {
+            if(path[i] == '~' && i + 1 < end && (path[i + 1] == '0' || path[i + 1] == '1'))
+                token += path[++i] == '0' ? '~' : '/';
+            else
+                token += path[i];
+        }
+        tokens.push_back(token);
+        start = end + 1;
+    }
+    return tokens;
+}
+
+// -----------------------------------------------------------------------------
+
+// The JSON Pointer made of the first 'count' tokens.
+
+std::string PointerFromTokens(const std::vector<std::string> &tokens, size_t count)
+{
+    std::string path;
+    for(size_t i = 0; i < count; ++i)
+    {
+        path += '/';
+        for(char c : tokens[i])
+        {
+            if(c == '~')
+                path += "~0";
+            else if(c == '/')
+                path += "~1";
+            else
+                path += c;
+        }
+    }
+    return path;
+}
+
+// -----------------------------------------------------------------------------
+
+// Reads the "indexes" setting, an array of { "container": pointer, "key":
+// pointer relative to each element }.
+
+void LoadFieldIndexes()
+{
+    fieldIndexes.clear();
+    if(!jsettings.contains("indexes"))
+        return;
+
+    const jsoncons::json &specs = jsettings.at("indexes");
+    if(!specs.is_array())
+    {
+        std::cerr << "The indexes setting must be an array" << std::endl;
+        return;
+    }
+
+    for(const auto &spec : specs.array_range())
+    {
+        if(!spec.contains("container") || !spec.contains("key"))
+        {
+            std::cerr << "Ignoring index without container or key: " << spec << std::endl;
+            continue;
+        }
+        fieldIndexes.emplace_back(PointerTokens(spec.at("container").as_string()), spec.at("key").as_string());
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+FieldIndex<Json> *FindFieldIndex(const std::vector<std::string> &container, const std::string &keyPointer)
+{
+    for(auto &index : fieldIndexes)
+        if(index.Container() == container && index.KeyPointer() == keyPointer)
+            return &index;
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+// The positions of the elements of 'array', found at 'container', whose value
+// at 'keyPointer' equals the scalar 'literal' as jsoncons compares them. Uses
+// an index when one is configured and its keys compare the same way, and
+// scans otherwise; both give the same positions in the same order.
+
+std::vector<size_t> MatchingPositions(const Json &array, const std::vector<std::string> &container,
+                                      const std::string &keyPointer, const jsoncons::json &literal)
+{
+    IndexKey key;
+    FieldIndex<Json> *index = MakeIndexKey(literal, key) && key.Exact() ? FindFieldIndex(container, keyPointer) : 0;
+    if(index)
+        return index->Find(array, key);
+
+    // The literal in the document's own type, for jsoncons to compare.
+    ArenaScope scope(&requestArena);
+    Json value = Json::parse(literal.to_string());
+
+    std::vector<size_t> positions;
+    for(size_t position = 0; position < array.size(); ++position)
+    {
+        std::error_code ec;
+        const Json &candidate = jsoncons::jsonpointer::get(array[position], keyPointer, ec);
+        if(!ec && candidate == value)
+            positions.push_back(position);
+    }
+    return positions;
+}
+
+// -----------------------------------------------------------------------------
+
+// How to order and cut an array answer: ?sort=<pointer>&order=asc|desc&limit=n.
+// "sort" is a JSON Pointer into each element and may be empty for the
+// element itself; elements without a scalar there come last, in document
+// order.
+
+struct SortSpec
+{
+    bool        active     = false;
+    bool        hasKey     = false;
+    std::string keyPointer;
+    bool        descending = false;
+    size_t      limit      = std::numeric_limits<size_t>::max();
+};
+
+// -----------------------------------------------------------------------------
+
+bool ParseSortSpec(std::map<std::string, std::string> &params, SortSpec &sort)
+{
+    sort.active = params.count("sort") || params.count("limit");
+    sort.hasKey = params.count("sort");
+    if(sort.hasKey)
+        sort.keyPointer = params["sort"];
+
+    if(params.count("order"))
+    {
+        if(params["order"] != "asc" && params["order"] != "desc")
+            return false;
+        sort.descending = params["order"] == "desc";
+    }
+
+    if(params.count("limit"))
+    {
+        // Digits only, and no more than fit.
+        const std::string &limit = params["limit"];
+        if(limit.empty() || limit.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        char *end = 0;
+        errno = 0;
+        unsigned long long value = strtoull(limit.c_str(), &end, 10);
+        if(errno == ERANGE || *end || value > std::numeric_limits<size_t>::max())
+            return false;
+        sort.limit = (size_t)value;
+    }
+    return !sort.hasKey || sort.keyPointer.empty() || sort.keyPointer[0] == '/';
+}
+
+// -----------------------------------------------------------------------------
+
+// The positions of the first sort.limit elements of 'array' in sort order,
+// taken from 'candidates' if given and otherwise from the whole array. When
+// the array is in the document at 'container' and has an index on the sort
+// key, the index is read in key order and only as far as needed; pass a
+// null 'container' for arrays that aren't. Otherwise the keys are taken once
+// and positions partially sorted by them, O(n log k), without copying any
+// element. Ties keep document order. Call with indexMutex held when
+// 'container' is given.
+
+std::vector<size_t> SortedPositions(const Json &array, const std::vector<std::string> *container,
+                                    const SortSpec &sort, const std::vector<size_t> *candidates)
+{
+    FieldIndex<Json> *index = candidates || !container || !sort.hasKey ? 0 : FindFieldIndex(*container, sort.keyPointer);
+    std::vector<size_t> positions;
+    if(index)
+    {
+        const FieldIndex<Json>::Entries &entries = index->All(array);
+        auto take = [&](const std::vector<size_t> &keyed)
+        {
+            for(size_t position : keyed)
+            {
+                if(positions.size() == sort.limit)
+                    return;
+                positions.push_back(position);
+            }
+        };
+        if(sort.descending)
+            for(auto entry = entries.rbegin(); entry != entries.rend(); ++entry)
+                take(entry->second);
+        else
+            for(auto entry = entries.begin(); entry != entries.end(); ++entry)
+                take(entry->second);
+
+        // Short of the limit, every keyed element is in; the rest follow.
+        if(positions.size() < sort.limit && positions.size() < array.size())
+        {
+            std::vector<bool> keyed(array.size(), false);
+            for(size_t position : positions)
+                keyed[position] = true;
+            for(size_t position = 0; position < array.size() && positions.size() < sort.limit; ++position)
+                if(!keyed[position])
+                    positions.push_back(position);
+        }
+        return positions;
+    }
+
+    if(candidates)
+        positions = *candidates;
+    else
+    {
+        positions.resize(array.size());
+        std::iota(positions.begin(), positions.end(), size_t(0));
+    }
+
+    size_t count = std::min(sort.limit, positions.size());
+    if(!sort.hasKey)
+    {
+        positions.resize(count);
+        return positions;
+    }
+
+    std::vector<IndexKey> keys(positions.size());
+    std::vector<char>     keyed(positions.size());
+    for(size_t i = 0; i < positions.size(); ++i)
+        keyed[i] = ElementKey(array[positions[i]], sort.keyPointer, keys[i]);
+
+    std::vector<size_t> order(positions.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::partial_sort(order.begin(), order.begin() + count, order.end(), [&](size_t a, size_t b)
+    {
+        if(keyed[a] != keyed[b])
+            return keyed[a] > keyed[b];
+        if(keyed[a] && !(keys[a] == keys[b]))
+            return sort.descending ? keys[b] < keys[a] : keys[a] < keys[b];
+        return a < b;
+    });
+
+    std::vector<size_t> sorted(count);
+    for(size_t i = 0; i < count; ++i)
+        sorted[i] = positions[order[i]];
+    return sorted;
+}
+
+// -----------------------------------------------------------------------------
+
+// Recognizes the equality filters "$[?(@.a.b == literal)]" and
+// "$[?@.a.b == literal]", giving the key as a JSON Pointer ("/a/b").
+
+bool ParseEqualityFilter(const std::string &query, std::string &keyPointer, jsoncons::json &literal)
+{
+    static const std::regex filter(
+        R"(^\$\[\?(\()?\s*@((?:\.[A-Za-z_][A-Za-z0-9_]*)+)\s*==\s*)"
+        R"((-?[0-9]+(?:\.[0-9]+)?(?:[eE][+-]?[0-9]+)?|'[^'\\]*'|"[^"\\]*"|true|false|null))"
+        R"(\s*(\))?\]$)");
+
+    std::smatch match;
+    if(!std::regex_match(query, match, filter) || match[1].matched != match[4].matched)
+        return false;
+
+    keyPointer = match[2].str();
+    std::replace(keyPointer.begin(), keyPointer.end(), '.', '/');
+
+    std::string value = match[3].str();
+    if(value[0] == '\'')
+        literal = jsoncons::json(value.substr(1, value.size() - 2));
+    else
+        literal = jsoncons::json::parse(value);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Decodes the QUERY_STRING into name/value pairs.
+
+std::map<std::string, std::string> ParseQueryString(const char *queryString)
+{
+    std::map<std::string, std::string> params;
+    if(!queryString)
+        return params;
+
+    auto decode = [](const std::string &text)
+    {
+        std::string result;
+        for(size_t i = 0; i < text.size(); ++i)
+        {
+            if(text[i] == '+')
+                result += ' ';
+            else if(text[i] == '%' && i + 2 < text.size() && std::isxdigit(static_cast<unsigned char>(text[i + 1]))
+                                  && std::isxdigit(static_cast<unsigned char>(text[i + 2])))
+            {
+                result += static_cast<char>(std::stoi(text.substr(i + 1, 2), 0, 16));
+                i += 2;
+            }
+            else
+                result += text[i];
+        }
+        return result;
+    };
+
+    std::stringstream in(queryString);
+    std::string pair;
+    while(std::getline(in, pair, '&'))
+    {
+        if(pair.empty())
+            continue;
+        size_t eq = pair.find('=');
+        if(eq == std::string::npos)
+            params[decode(pair)] = "";
+        else
+            params[decode(pair.substr(0, eq))] = decode(pair.substr(eq + 1));
+    }
+    return params;
+}
+
+// -----------------------------------------------------------------------------
+
+// Returns the compiled form of a query, compiling and caching it on a miss.
+// Queries starting with '$' are JSONPath, anything else JMESPath. Compile
+// errors are thrown as jsonpath_error or jmespath_error and not cached.
+
+std::shared_ptr<CompiledQuery> CompileQuery(const std::string &query)
+{
+    {
+        const std::lock_guard<std::mutex> lock(queryCacheMutex);
+        std::shared_ptr<CompiledQuery> *cached = queryCache.Find(query);
+        if(cached)
+            return *cached;
+    }
+
+    // The expressions hold literals that must outlive the request arena.
+    ArenaScope noArena(0);
+
+    std::shared_ptr<CompiledQuery> compiled = std::make_shared<CompiledQuery>();
+    if(query.at(0) == '$')
+    {
+        compiled->jsonpath.reset(new JsonPathExpression(jsoncons::jsonpath::make_expression<Json>(query)));
+
+        jsoncons::json literal;
+        compiled->equalityFilter = ParseEqualityFilter(query, compiled->keyPointer, literal) 
+                                && MakeIndexKey(literal, compiled->key) && compiled->key.Exact();
+    }
+    else
+        compiled->jmespath.reset(new JmesPathExpression(jsoncons::jmespath::make_expression<Json>(query)));
+
+    const std::lock_guard<std::mutex> lock(queryCacheMutex);
+    return queryCache.Insert(query, compiled);
+}
+
+// -----------------------------------------------------------------------------
+
+// The rows an element-wise view gets from one element of its source. Built
+// wherever the caller's arena scope points.
+
+Json ElementRows(const MaterializedView &view, const Json &element)
+{
+    Json slice(jsoncons::json_array_arg);
+    slice.emplace_back(jsoncons::json_const_pointer_arg, &element);
+    if(view.compiled->jsonpath)
+        return view.compiled->jsonpath->evaluate(slice);
+    return view.compiled->jmespath->evaluate(slice);
+}
+
+// -----------------------------------------------------------------------------
+
+// A copy of 'value' that refers to nothing else. Copying a json_const_pointer_arg
+// value, as a query over a slice of pointers may return, copies the pointer,
+// which dangles once the document changes. Built wherever the caller's arena
+// scope points.
+
+Json DeepCopy(const Json &value)
+{
+    if(value.is_array())
+    {
+        Json copy(jsoncons::json_array_arg);
+        copy.reserve(value.size());
+        for(const Json &element : value.array_range())
+            copy.push_back(DeepCopy(element));
+        return copy;
+    }
+    if(value.is_object())
+    {
+        Json copy(jsoncons::json_object_arg);
+        for(const auto &member : value.object_range())
+            copy.insert_or_assign(member.key(), DeepCopy(member.value()));
+        return copy;
+    }
+    if(value.is_string())
+        return Json(value.as_string_view(), value.tag());
+    if(value.is_byte_string())
+        return Json(jsoncons::byte_string_arg, value.as_byte_string_view(), value.tag());
+    if(value.is_bool())
+        return Json(value.as_bool(), value.tag());
+    if(value.is_null())
+        return Json::null();
+    if(value.is_double())
+        return Json(value.as_double(), value.tag());
+    if(value.is_int64())
+        return Json(value.as<int64_t>(), value.tag());
+    return Json(value.as<uint64_t>(), value.tag());
+}
+
+// -----------------------------------------------------------------------------
+
+// Puts the rows of element 'position' of the source into the view at 'offset'
+// and returns how many there were.
+
+size_t InsertElementRows(MaterializedView &view, const Json &element, size_t offset)
+{
+    ArenaScope scope(&requestArena);
+    Json rows = ElementRows(view, element);
+    if(!rows.is_array())
+        throw std::runtime_error("element-wise view query gave no array");
+
+    // Views outlive the request and the element: copy deep, don't move.
+    ArenaScope noArena(0);
+    for(const Json &row : rows.array_range())
+        view.rows.insert(view.rows.array_range().begin() + offset++, DeepCopy(row));
+    return rows.size();
+}
+
+// -----------------------------------------------------------------------------
+
+// Applies the write at 'tokens' to the views whose source is at or above it.
+// Called with docMutex held exclusively, after the write.
+
+void NoteViewWrite(const std::vector<std::string> &tokens, WriteKind kind)
+{
+    for(auto &entry : views)
+    {
+        MaterializedView &view = entry.second;
+        const std::vector<std::string> &source = view.source;
+        size_t common = std::min(tokens.size(), source.size());
+        if(view.stale || !std::equal(tokens.begin(), tokens.begin() + common, source.begin()))
+            continue;
+
+        // Writes to the source itself or above it replace it.
+        const std::string *step = tokens.size() > source.size() ? &tokens[source.size()] : 0;
+        if(!view.tracked || view.kind == MaterializedView::QUERY || !step 
+           || step->empty() || step->find_first_not_of("0123456789") != std::string::npos)
+        {
+            view.stale = true;
+            continue;
+        }
+
+        std::error_code ec;
+        const Json &array = jsoncons::jsonpointer::get(jdoc, PointerFromTokens(source, source.size()), ec);
+        size_t position = std::stoul(*step);
+        bool whole = tokens.size() == source.size() + 1;
+        if(ec || !array.is_array())
+        {
+            view.stale = true;
+            continue;
+        }
+
+        if(view.kind == MaterializedView::AGGREGATE)
+        {
+            // Min and max can't be taken back, so only appends are deltas.
+            if(whole && kind == WRITE_INSERTED && position + 1 == array.size())
+            {
+                view.aggregation->Add(array[position]);
+                view.dirty = true;
+                ++view.deltas;
+            }
+            else
+                view.stale = true;
+            continue;
+        }
+
+        size_t elements = view.counts.size() + (whole && kind == WRITE_INSERTED ? 1 : 0) - (whole && kind == WRITE_REMOVED ? 1 : 0);
+        if(elements != array.size() || position > view.counts.size() || (position == view.counts.size() && !(whole && kind == WRITE_INSERTED)))
+        {
+            view.stale = true;
+            continue;
+        }
+
+        size_t offset = std::accumulate(view.counts.begin(), view.counts.begin() + position, size_t(0));
+        try 
+        {
+            if(!(whole && kind == WRITE_INSERTED))
+            {
+                auto begin = view.rows.array_range().begin() + offset;
+                view.rows.erase(begin, begin + view.counts[position]);
+            }
+
+            if(whole && kind == WRITE_INSERTED)
+                view.counts.insert(view.counts.begin() + position, InsertElementRows(view, array[position], offset));
+            else if(whole && kind == WRITE_REMOVED)
+                view.counts.erase(view.counts.begin() + position);
+            else
+                view.counts[position] = InsertElementRows(view, array[position], offset);
+        }
+        catch(const std::exception &e)
+        {
+            std::cerr << "Recomputing view " << entry.first << ": " << e.what() << std::endl;
+            view.stale = true;
+            continue;
+        }
+        view.dirty = true;
+        ++view.deltas;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// Rebuilds a view from its source. Returns false when the source is missing.
+// Called with docMutex shared and viewMutex held.
+
+bool RecomputeView(MaterializedView &view)
+{
+    std::error_code ec;
+    const Json &node = jsoncons::jsonpointer::get(jdoc, PointerFromTokens(view.source, view.source.size()), ec);
+    if(ec)
+        return false;
+
+    ++view.recomputes;
+    view.dirty   = true;
+    view.tracked = node.is_array();
+    view.counts.clear();
+    {
+        ArenaScope noArena(0);
+        view.rows = Json(jsoncons::json_array_arg);
+    }
+
+    if(view.kind == MaterializedView::AGGREGATE)
+    {
+        view.aggregation->Clear();
+        if(view.tracked)
+            view.aggregation->Run(node);
+    }
+    else if(view.kind == MaterializedView::ELEMENTWISE && view.tracked)
+    {
+        view.counts.reserve(node.size());
+        for(const Json &element : node.array_range())
+            view.counts.push_back(InsertElementRows(view, element, view.rows.size()));
+    }
+    else
+    {
+        ArenaScope scope(&requestArena);
+        Json result = view.compiled->jsonpath ? view.compiled->jsonpath->evaluate(node) 
+                                              : view.compiled->jmespath->evaluate(node);
+        ArenaScope noArena(0);
+        view.rows = result;
+    }
+
+    view.stale = false;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Reads the "views" setting, an object of named views:
+//
+//     "views" : { "open-orders" : { "source" : "/orders", "query" : "[?state == 'open']" },
+//                 "quantities"  : { "source" : "/orders", "aggregate" : { "field" : "/Quantity" } } }
+//
+// "query" is JSONPath or JMESPath run on the source, "aggregate" a spec as
+// for aggregation requests.
+
+void LoadViews()
+{
+    views.clear();
+    if(!jsettings.contains("views"))
+        return;
+
+    const jsoncons::json &specs = jsettings.at("views");
+    if(!specs.is_object())
+    {
+        std::cerr << "The views setting must be an object" << std::endl;
+        return;
+    }
+
+    for(const auto &member : specs.object_range())
+    {
+        const jsoncons::json &spec = member.value();
+        MaterializedView view;
+        view.source = PointerTokens(spec.get_value_or<std::string>("source", ""));
+
+        try 
+        {
+            if(spec.contains("query"))
+            {
+                std::string query = spec.at("query").as_string();
+                std::vector<std::string> prefix;
+                std::string elementwise;
+                if(SplitElementwiseQuery(query, prefix, elementwise))
+                {
+                    view.kind = MaterializedView::ELEMENTWISE;
+                    view.source.insert(view.source.end(), prefix.begin(), prefix.end());
+                    view.compiled = CompileQuery(elementwise);
+                }
+                else
+                {
+                    view.kind = MaterializedView::QUERY;
+                    view.compiled = CompileQuery(query);
+                }
+            }
+            else if(spec.contains("aggregate"))
+            {
+                const jsoncons::json &aggregate = spec.at("aggregate");
+                bool hasField = aggregate.contains("field");
+                bool hasGroup = aggregate.contains("groupby");
+                view.kind = MaterializedView::AGGREGATE;
+                view.aggregation.reset(new Aggregation<Json>(
+                    hasField, hasField ? PointerTokens(aggregate.at("field").as_string()) : std::vector<std::string>(),
+                    hasGroup, hasGroup ? PointerTokens(aggregate.at("groupby").as_string()) : std::vector<std::string>()));
+            }
+            else
+            {
+                std::cerr << "Ignoring view without query or aggregate: " << member.key() << std::endl;
+                continue;
+            }
+        }
+        catch(const std::exception &e)
+        {
+            std::cerr << "Ignoring view " << member.key() << ": " << e.what() << std::endl;
+            continue;
+        }
+
+        views.emplace(member.key(), std::move(view));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// Brings the path versions, field indexes and views up to date after a write
+// at 'tokens'. Writes to an element, or anywhere inside one, update that
+// element's index entry; writes to a container or above it mark its indexes
+// for a rebuild.
+
+void NoteWrite(const std::vector<std::string> &tokens, WriteKind kind)
+{
+    // Inserting or removing anywhere but at the end of an array shifts the
+    // elements after it, which changes the whole array.
+    std::vector<std::string> touched = tokens;
+    if(kind != WRITE_CHANGED && !tokens.empty())
+    {
+        std::error_code ec;
+        const Json &parent = jsoncons::jsonpointer::get(jdoc, PointerFromTokens(tokens, tokens.size() - 1), ec);
+        const std::string &step = tokens.back();
+        bool atEnd = !ec && !step.empty() && step.find_first_not_of("0123456789") == std::string::npos
+                  && std::stoul(step) + (kind == WRITE_INSERTED ? 1 : 0) == parent.size();
+        if(!atEnd)
+            touched.pop_back();
+    }
+
+    {
+        const std::lock_guard<std::shared_mutex> lock(resultMutex);
+        pathVersions.Touch(touched);
+    }
+
+    for(auto &index : fieldIndexes)
+    {
+        const std::vector<std::string> &container = index.Container();
+        size_t common = std::min(tokens.size(), container.size());
+        if(!std::equal(tokens.begin(), tokens.begin() + common, container.begin()))
+            continue;
+
+        if(tokens.size() <= container.size())
+        {
+            index.Invalidate();
+            continue;
+        }
+
+        std::error_code ec;
+        const Json &array = jsoncons::jsonpointer::get(jdoc, PointerFromTokens(container, container.size()), ec);
+        const std::string &step = tokens[container.size()];
+        if(ec || !array.is_array() || step.empty() || step.find_first_not_of("0123456789") != std::string::npos)
+        {
+            index.Invalidate();
+            continue;
+        }
+
+        size_t position = std::stoul(step);
+        if(tokens.size() == container.size() + 1 && kind == WRITE_INSERTED)
+            index.Insert(array, position);
+        else if(tokens.size() == container.size() + 1 && kind == WRITE_REMOVED)
+            index.Remove(position);
+        else
+            index.Set(array, position);
+    }
+
+    NoteViewWrite(tokens, kind);
+}
+
+// -----------------------------------------------------------------------------
+
+// The partition arenas of this request thread, one per worker pool slot.
+
+std::vector<std::unique_ptr<RequestArena>> &PartitionArenas()
+{
+    while(partitionArenas.size() <= workerPool.Size())
+        partitionArenas.emplace_back(new RequestArena);
+    return partitionArenas;
+}
+
+// -----------------------------------------------------------------------------
+
+// The number of elements and members in 'node' at any depth, counted no
+// further than 'limit', so what it costs is bounded by that.
+
+size_t DeepSize(const Json &node, size_t limit)
+{
+    size_t size = 0;
+    std::vector<const Json *> pending(1, &node);
+    while(!pending.empty() && size < limit)
+    {
+        const Json *value = pending.back();
+        pending.pop_back();
+        if(value->is_array())
+        {
+            size += value->size();
+            for(const Json &element : value->array_range())
+                if(element.is_array() || element.is_object())
+                    pending.push_back(&element);
+        }
+        else if(value->is_object())
+        {
+            size += value->size();
+            for(const auto &member : value->object_range())
+                if(member.value().is_array() || member.value().is_object())
+                    pending.push_back(&member.value());
+        }
+    }
+    return std::min(size, limit);
+}
+
+// -----------------------------------------------------------------------------
+
+// Pins the snapshot of 'node', found at 'path' at 'version', copying it unless
+// a snapshot of that version is already around. Returns null when 'node' is
+// small enough for the query to run on it under the lock instead. Call with
+// docMutex held.
+
+std::shared_ptr<const Json> PinSnapshot(const std::string &path, uint64_t version, const Json &node)
+{
+    if(DeepSize(node, snapshotMin) < snapshotMin)
+        return std::shared_ptr<const Json>();
+
+    {
+        const std::lock_guard<std::mutex> lock(snapshotMutex);
+        Snapshot *snapshot = snapshotCache.Find(path);
+        if(snapshot && snapshot->version == version)
+            return snapshot->value;
+    }
+
+    std::shared_ptr<const Json> copy;
+    {
+        // Snapshots outlive the request.
+        ArenaScope noArena(0);
+        copy = std::make_shared<const Json>(node);
+    }
+
+    const std::lock_guard<std::mutex> lock(snapshotMutex);
+    snapshotCache.Insert(path, Snapshot{version, copy});
+    return copy;
+}
+
+// -----------------------------------------------------------------------------
+
+// Evaluates an element-wise query (see SplitElementwiseQuery) over a large
+// array in slices of PARTITION_SIZE elements: on the worker pool when the
+// array reaches parallelThreshold, one slice after the other when 'limits'
+// are in force, so the deadline and budget are checked between slices.
+// Slices hold pointers to the array's elements rather than copies, and
+// the partial results are moved, in order, into one array that is exactly
+// the sequential result. Returns false, leaving 'buffer' alone, when the
+// query or the array doesn't qualify.
+
+bool EvaluatePartitioned(const Json &node, const std::string &query, QueryLimits &limits, std::string &buffer)
+{
+    std::vector<std::string> prefix;
+    std::string elementwise;
+    if(!SplitElementwiseQuery(query, prefix, elementwise))
+        return false;
+
+    std::error_code ec;
+    const Json &array = prefix.empty() ? node : jsoncons::jsonpointer::get(node, PointerFromTokens(prefix, prefix.size()), ec);
+    if(ec || !array.is_array())
+        return false;
+
+    bool parallel = workerPool.Size() && parallelThreshold && array.size() >= parallelThreshold;
+    if(!parallel && !(limits.Active() && array.size() > PARTITION_SIZE))
+        return false;
+
+    std::shared_ptr<CompiledQuery> compiled = CompileQuery(elementwise);
+
+    size_t parts = (array.size() + PARTITION_SIZE - 1) / PARTITION_SIZE;
+    if(parallel)
+        parts = std::max(parts, workerPool.Size() + 1);
+
+    // The arenas of this thread, not those of the worker running a part.
+    std::vector<std::unique_ptr<RequestArena>> &arenas = PartitionArenas();
+
+    auto evaluate = [&](size_t begin, size_t end, size_t slot) -> Json
+    {
+        limits.Charge(end - begin);
+
+        ArenaScope scope(arenas[slot].get());
+        Json slice = SliceOf(array, begin, end);
+        Json partial = compiled->jsonpath ? compiled->jsonpath->evaluate(slice) 
+                                          : compiled->jmespath->evaluate(slice);
+
+        // What the engine spent on the slice stops the query here.
+        limits.Check();
+        return partial;
+    };
+
+    Json result;
+    if(!EvaluateInParts(array, parts, parallel ? &workerPool : 0, evaluate, result))
+        return false;
+
+    result.dump(buffer, jsoncons::indenting::indent);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// A rough bound on the work of a query over 'node', counted in the elements
+// and members it holds at any depth. A query without wildcards, filters or
+// flattening follows one path and costs 1. Otherwise each of those steps
+// visits each node below at most once, so the query costs the size of 'node',
+// times that size again for every recursive descent past the first, which
+// may start over from every node. Text inside string and JSON literals is
+// skipped. 'node' is measured no further than needed to exceed 'ceiling'.
+
+double EstimateQueryCost(const std::string &query, const Json &node, double ceiling)
+{
+    int steps = 0, descents = 0;
+    char quote = 0;
+    for(size_t i = 0; i < query.size(); ++i)
+    {
+        char c = query[i];
+        if(quote)
+        {
+            if(c == '\\')
+                ++i;
+            else if(c == quote)
+                quote = 0;
+        }
+        else if(c == '\'' || c == '"' || c == '`')
+            quote = c;
+        else if(c == '.' && i + 1 < query.size() && query[i + 1] == '.')
+        {
+            ++steps;
+            ++descents;
+            ++i;
+        }
+        else if(c == '*')
+            ++steps;
+        else if(c == '[' && i + 1 < query.size() && (query[i + 1] == '?' || query[i + 1] == ']'))
+            ++steps;
+    }
+    if(steps == 0)
+        return 1;
+
+    int exponent = std::max(1, descents);
+    double limit = std::min(std::ceil(std::pow(ceiling, 1.0 / exponent)) + 1, 1e18);
+    double size = std::max<double>(2, DeepSize(node, (size_t)limit));
+    return std::pow(size, exponent);
+}
+
+// -----------------------------------------------------------------------------
+
+// Spends 'limits' on everything built in the request and partition arenas
+// while in scope.
+
+class LimitsScope
+{
+public:
+    explicit LimitsScope(QueryLimits *limits)
+    {
+        requestArena.SetLimits(limits);
+        for(auto &arena : PartitionArenas())
+            arena->SetLimits(limits);
+    }
+
+    ~LimitsScope()
+    {
+        requestArena.SetLimits(0);
+        for(auto &arena : PartitionArenas())
+            arena->SetLimits(0);
+    }
+};
+
 // -----------------------------------------------------------------------------
 
 bool UnSerializeFromFile() 
 {
-    const std::lock_guard<std::recursive_mutex> lock(docMutex);
+    const std::lock_guard<std::shared_mutex> lock(docMutex);
     std::string filename = jsettings["datafile"].as_string();
     std::ifstream in(filename);
     
@@ -112,7 +1212,7 @@ bool UnSerializeFromFile()
     {
         try 
         {
-            jdoc = jsoncons::json::parse(in);
+            jdoc = Json::parse(in);
         }
         catch(const jsoncons::ser_error& e) 
         {
@@ -123,6 +1223,9 @@ bool UnSerializeFromFile()
             return false;
         }
 
+        for(auto &view : views)
+            view.second.stale = true;
+
         lastModified =  local_clock::now();
         std::cout << "Read in " << filename << std::endl;
         return true;
@@ -136,7 +1239,8 @@ bool UnSerializeFromFile()
 
 bool SerializeToFile()
 {
-    const std::lock_guard<std::recursive_mutex> lock(docMutex);
+    const std::lock_guard<std::mutex> saving(saveMutex);
+    const std::shared_lock<std::shared_mutex> lock(docMutex);
     std::ofstream ofs(jsettings["datafile"].as_string());
     if(ofs.is_open()) 
     {
@@ -152,8 +1256,11 @@ bool SerializeToFile()
 
 void AddLastModifiedHeader()
 {
+    // gmtime's buffer is shared by all threads.
     std::time_t t = local_clock::to_time_t(lastModified);
-    std::cout << std::put_time(std::gmtime(&t), "Last-Modified: %a, %d  %b %Y %H:%M:%S %Z\r\n");
+    std::tm utc;
+    gmtime_r(&t, &utc);
+    *fcgiOut << std::put_time(&utc, "Last-Modified: %a, %d  %b %Y %H:%M:%S %Z\r\n");
 }
 
 // -----------------------------------------------------------------------------
@@ -162,7 +1269,6 @@ std::string GetETag(const std::string &buffer)
 {
     unsigned char result[MD5_DIGEST_LENGTH];    
 
-    // printf("Buffer size is %lu\n", buffer.size());
     MD5((const unsigned char*)(buffer.c_str()), buffer.size(), result);
 
     std::stringstream oss;    
@@ -177,109 +1283,492 @@ std::string GetETag(const std::string &buffer)
 
 void AddETagFromBuffer(const std::string& buffer)
 {
-    std::cout << "ETag: " << GetETag(buffer) << "\r\n";
+    *fcgiOut << "ETag: " << GetETag(buffer) << "\r\n";
+}
+
+// -----------------------------------------------------------------------------
+
+// The strong ETag of the node at 'tokens', "epoch.version", without looking
+// at the node itself: the cost is the depth of the path, not the size of the
+// node. Caller holds docMutex, which writers hold while bumping versions.
+
+std::string VersionETag(const std::vector<std::string> &tokens)
+{
+    return "\"" + std::to_string(epoch) + "." + std::to_string(pathVersions.Version(tokens)) + "\"";
+}
+
+// -----------------------------------------------------------------------------
+
+// Evaluates the If-Match and If-None-Match headers of 'req' against 'etag',
+// empty when the target doesn't exist, and answers for a failed one. 'read'
+// is true for GET and HEAD. Returns whether the request should go on.
+
+bool PreconditionsHold(FCGX_Request &req, const std::string &etag, bool read)
+{
+    switch(EvaluatePreconditions(FCGX_GetParam("HTTP_IF_MATCH", req.envp), FCGX_GetParam("HTTP_IF_NONE_MATCH", req.envp), etag, read))
+    {
+        case PRECONDITION_HOLDS:
+            return true;
+        case PRECONDITION_NOT_MODIFIED:
+            *fcgiOut << NOT_MODIFIED_HEADER << "ETag: " << etag << "\r\n" << END_HEADERS;
+            return false;
+        case PRECONDITION_FAILED:
+            break;
+    }
+    *fcgiOut << PRECONDITION_FAILED_HEADER << END_HEADERS;
+    return false;
+}
+
+
+// -----------------------------------------------------------------------------
+
+void AddJsonFromBuffer(const std::string &buffer)
+{
+    *fcgiOut << CONTENT_DISPOSITION_HEADER << JSON_HEADER << END_HEADERS << buffer << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+// The array of the elements of 'array' at 'positions', formatted exactly like
+// a JSONPath result. With 'limits', they are checked between elements.
+
+std::string DumpSelection(const Json &array, const std::vector<size_t> &positions, const QueryLimits *limits = 0)
+{
+    ArenaScope scope(&requestArena);
+    Json result(jsoncons::json_array_arg);
+    result.reserve(positions.size());
+    for(size_t position : positions)
+    {
+        if(limits)
+            limits->Check();
+        result.push_back(array[position]);
+    }
+
+    std::string buffer;
+    result.dump(buffer, jsoncons::indenting::indent);
+    return buffer;
+}
+
+
+// -----------------------------------------------------------------------------
+
+void HandleFCGIGet(const char *path, FCGX_Request &req) 
+{
+
+    // let's get the document 
+    const std::shared_lock<std::shared_mutex> lock(docMutex);
+    AddLastModifiedHeader();
+        
+    std::istreambuf_iterator<char> begin(*fcgiIn), end;
+    std::string query(begin, end);
+
+    std::error_code ec;
+    const Json& currentNode = jsoncons::jsonpointer::get(jdoc, path, ec);
+    std::string etag = ec ? std::string() : VersionETag(PointerTokens(path));
+    if(!PreconditionsHold(req, etag, true))
+        return;
+    if (ec)
+    {
+        *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;
+        return;
+    }
+
+    // ?key=/Id&equals=78912 selects the elements of an array by a field,
+    // ?sort=/Time&order=desc&limit=50 orders and cuts them.
+    std::map<std::string, std::string> params = ParseQueryString(FCGX_GetParam("QUERY_STRING", req.envp));
+    SortSpec sort;
+    if(!ParseSortSpec(params, sort) || (sort.active && !currentNode.is_array()))
+    {
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
+
+    if(params.count("key") && params.count("equals"))
+    {
+        jsoncons::json literal;
+        try 
+        {
+            literal = jsoncons::json::parse(params["equals"]);
+        }
+        catch(const jsoncons::ser_error&) 
+        {
+            literal = jsoncons::json(params["equals"]);
+        }
+
+        IndexKey key;
+        if(!currentNode.is_array() || !MakeIndexKey(literal, key))
+        {
+            *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+            return;
+        }
+        const std::lock_guard<std::mutex> indexLock(indexMutex);
+        std::vector<std::string> tokens = PointerTokens(path);
+        std::vector<size_t> positions = MatchingPositions(currentNode, tokens, params["key"], literal);
+        if(sort.active)
+            positions = SortedPositions(currentNode, &tokens, sort, &positions);
+        std::string buffer = DumpSelection(currentNode, positions);
+        AddETagFromBuffer(buffer);
+        AddJsonFromBuffer(buffer);
+        return;
+    }
+
+    if(sort.active)
+    {
+        std::vector<std::string> tokens = PointerTokens(path);
+        const std::lock_guard<std::mutex> indexLock(indexMutex);
+        std::string buffer = DumpSelection(currentNode, SortedPositions(currentNode, &tokens, sort, 0));
+        AddETagFromBuffer(buffer);
+        AddJsonFromBuffer(buffer);
+        return;
+    }
+
+    std::string buffer;
+    currentNode.dump(buffer, jsoncons::indenting::indent);
+    *fcgiOut << "ETag: " << etag << "\r\n";
+    AddJsonFromBuffer(buffer);
 }
 
 
+// Aggregates the elements of the array at 'path' as asked by the body:
+//
+//     { "field" : "/Quantity", "groupby" : "/Customer" }
+//
+// Both members are optional JSON Pointers into each element; see
+// Aggregation.h for the result. One pass under the shared document lock.
+
+void HandleFCGIAggregate(const char *path, FCGX_Request &req)
+{
+    ArenaScope scope(&requestArena);
+
+    Json spec;
+    try 
+    {
+        spec = Json::parse(*fcgiIn);
+    }
+    catch(const jsoncons::ser_error& e) 
+    {
+        *fcgiErr << e.what();
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
+
+    bool valid = spec.is_object();
+    for(const char *member : { "field", "groupby" })
+        valid = valid && (!spec.contains(member) || spec.at(member).is_string());
+    if(!valid)
+    {
+        *fcgiErr << "Aggregation spec must be an object with string members \"field\" and \"groupby\"";
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
+
+    bool hasField = spec.contains("field");
+    bool hasGroup = spec.contains("groupby");
+    Aggregation<Json> aggregation(hasField, hasField ? PointerTokens(spec.at("field").as_string()) : std::vector<std::string>(),
+                                  hasGroup, hasGroup ? PointerTokens(spec.at("groupby").as_string()) : std::vector<std::string>());
+
+    std::string buffer;
+    {
+        const std::shared_lock<std::shared_mutex> lock(docMutex);
+        AddLastModifiedHeader();
+
+        std::error_code ec;
+        const Json& currentNode = jsoncons::jsonpointer::get(jdoc, path, ec);
+        if(ec)
+        {
+            *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;
+            return;
+        }
+        if(!currentNode.is_array())
+        {
+            *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+            return;
+        }
+
+        aggregation.Run(currentNode);
+    }
+
+    aggregation.Result().dump(buffer, jsoncons::indenting::indent);
+    AddETagFromBuffer(buffer);
+    AddJsonFromBuffer(buffer);
+}
+
 // -----------------------------------------------------------------------------
 
-void AddJsonFromBuffer(const std::string &buffer)
-{
-    std::cout << CONTENT_DISPOSITION_HEADER << JSON_HEADER << END_HEADERS << buffer << std::endl;
+// Reads several nodes in one request. The body is an array of JSON Pointers,
+// relative to 'path', and the answer an array with an object for each of
+// them in turn: the "pointer", a "status" of 200, 404 or 400 (for a pointer
+// that doesn't parse) and, when found, the node's "value" and "etag". All
+// nodes are read under one acquisition of the shared lock, so the answer is
+// a consistent view, and dumped straight into the one response buffer. Each
+// item's ETag is the one a GET of it would return; the ETag of the response
+// covers them all.
+
+void HandleFCGIBatch(const char *path, FCGX_Request &req)
+{
+    ArenaScope scope(&requestArena);
+
+    Json pointers;
+    try 
+    {
+        pointers = Json::parse(*fcgiIn);
+    }
+    catch(const jsoncons::ser_error& e) 
+    {
+        *fcgiErr << e.what();
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
+
+    bool valid = pointers.is_array();
+    for(size_t i = 0; valid && i < pointers.size(); ++i)
+        valid = pointers[i].is_string();
+    if(!valid)
+    {
+        *fcgiErr << "Batch to '" << path << "' is not an array of pointers." << std::endl;
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
+
+    std::string buffer = "[";
+    {
+        const std::shared_lock<std::shared_mutex> lock(docMutex);
+        AddLastModifiedHeader();
+
+        for(size_t i = 0; i < pointers.size(); ++i)
+        {
+            const Json &item = pointers[i];
+            std::string pointer = item.as_string();
+
+            buffer += i ? ",\n    { \"pointer\" : " : "\n    { \"pointer\" : ";
+            item.dump(buffer);
+
+            std::error_code ec;
+            const Json *node = 0;
+            if(pointer.empty() || pointer[0] == '/')
+                node = &jsoncons::jsonpointer::get(jdoc, path + pointer, ec);
+
+            if(!node || ec == jsoncons::jsonpointer::jsonpointer_errc::expected_0_or_1)
+                buffer += ", \"status\" : 400 }";
+            else if(ec)
+                buffer += ", \"status\" : 404 }";
+            else
+            {
+                buffer += ", \"status\" : 200, \"value\" : ";
+                node->dump(buffer, jsoncons::indenting::indent);
+                buffer += ", \"etag\" : ";
+                Json(VersionETag(PointerTokens(path + pointer))).dump(buffer);
+                buffer += " }";
+            }
+        }
+    }
+    buffer += pointers.empty() ? "]" : "\n]";
+
+    AddETagFromBuffer(buffer);
+    AddJsonFromBuffer(buffer);
 }
 
-
 // -----------------------------------------------------------------------------
 
-void HandleFCGIGet(const char *path, FCGX_Request &req) 
+void HandleFCGIPost(const char *path, FCGX_Request &req) 
 {
-
-    // let's get the document 
-    const std::lock_guard<std::recursive_mutex> lock(docMutex);
-    AddLastModifiedHeader();
-        
-    std::istreambuf_iterator<char> begin(std::cin), end;
-    std::string query(begin, end);
-
-    std::error_code ec;
-    const jsoncons::json& currentNode = jsoncons::jsonpointer::get(jdoc, path, ec);
-    if (ec)
+    const char *contentType = FCGX_GetParam("CONTENT_TYPE", req.envp);
+    if(contentType && AGGREGATE_MEDIA_TYPE == contentType)
     {
-        std::cout << NOT_FOUND_HEADER << END_HEADERS;
+        HandleFCGIAggregate(path, req);
+        return;
     }
-    else
+    if(contentType && BATCH_MEDIA_TYPE == contentType)
     {
-        std::string buffer;
-        currentNode.dump(buffer, jsoncons::indenting::indent);
-        AddETagFromBuffer(buffer);
-        AddJsonFromBuffer(buffer);
+        HandleFCGIBatch(path, req);
+        return;
     }
-}
 
+    std::istreambuf_iterator<char> begin(*fcgiIn), end;
+    std::string query(begin, end);
 
-void HandleFCGIPost(const char *path, FCGX_Request &req) 
-{
+    // Array results can be sorted and cut as for GET.
+    const char *queryString = FCGX_GetParam("QUERY_STRING", req.envp);
+    std::map<std::string, std::string> params = ParseQueryString(queryString);
+    SortSpec sort;
+    if(!ParseSortSpec(params, sort))
+    {
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
 
-    // let's get the document 
-    const std::lock_guard<std::recursive_mutex> lock(docMutex);
-    AddLastModifiedHeader();
-        
-    std::istreambuf_iterator<char> begin(std::cin), end;
-    std::string query(begin, end);
-    std::error_code ec;
-    const jsoncons::json& currentNode = jsoncons::jsonpointer::get(jdoc, path, ec);
-    if (ec)
+    // Repeated queries are answered from the result cache, without touching
+    // the document, for as long as the queried subtree is unchanged.
+    std::vector<std::string> tokens = PointerTokens(path);
+    std::string cacheKey = std::string(path) + '\0' + (sort.active ? queryString : "") + '\0' + query;
+    if(query.length() > 0)
     {
-        std::cout << NOT_FOUND_HEADER << END_HEADERS;
+        std::string buffer, etag;
+        bool hit;
+        {
+            const std::shared_lock<std::shared_mutex> lock(resultMutex);
+            hit = resultCache.Find(cacheKey, pathVersions.Version(tokens), buffer, etag);
+        }
+        if(hit)
+        {
+            AddLastModifiedHeader();
+            *fcgiOut << "ETag: " << etag << "\r\n";
+            AddJsonFromBuffer(buffer);
+            return;
+        }
     }
-    else
+
+    std::string buffer;
+    std::shared_ptr<CompiledQuery> compiled;
+    std::shared_ptr<const Json> snapshot;
+    const Json *subject = 0;
+    uint64_t version;
+
+    // let's get the document; it is let go early when there is a snapshot.
+    std::shared_lock<std::shared_mutex> docLock(docMutex);
     {
-        if(query.length() > 0)
+        AddLastModifiedHeader();
+
+        std::error_code ec;
+        const Json& currentNode = jsoncons::jsonpointer::get(jdoc, path, ec);
+        if (ec)
+        {
+            *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;
+            return;
+        }
+
+        if(query.length() == 0)
         {
-            // ok, we have a jsonpath or a jmespath
-            if(query.at(0) == '$')
+            if(sort.active && currentNode.is_array())
             {
-                // this is a jsonpath
-                try 
-                {
-                    auto res = jsoncons::jsonpath::json_query(currentNode, query);
-                    std::string buffer;                    
-                    res.dump(buffer, jsoncons::indenting::indent);                
-                    AddETagFromBuffer(buffer);             
-                    AddJsonFromBuffer(buffer);
-                }
-                catch(const jsoncons::jsonpath::jsonpath_error &e)
-                {
-                    std::cerr << e.what();
-                    std::cout << CLIENT_ERROR_HEADER << END_HEADERS;                    
-                }
+                const std::lock_guard<std::mutex> indexLock(indexMutex);
+                buffer = DumpSelection(currentNode, SortedPositions(currentNode, &tokens, sort, 0));
             }
             else
-            { 
-                // interpret as JMESPath.
-                try 
-                {
-                    auto res = jsoncons::jmespath::search(currentNode, query);
-                    std::string buffer;                    
-                    res.dump(buffer, jsoncons::indenting::indent);                
-                    AddETagFromBuffer(buffer);             
-                    AddJsonFromBuffer(buffer);
-                }
-                catch(const jsoncons::jmespath::jmespath_error &e)
-                {
-                    std::cerr << e.what();
-                    std::cout << CLIENT_ERROR_HEADER << END_HEADERS;                    
-                }
+                currentNode.dump(buffer, jsoncons::indenting::indent);
+            AddETagFromBuffer(buffer);
+            AddJsonFromBuffer(buffer);
+            return;
+        }
+
+        // Writers hold docMutex, so this is the version of what is evaluated.
+        version = pathVersions.Version(tokens);
+
+        // Turn away queries that are obviously too expensive for this node.
+        if(maxQueryCost > 0 && EstimateQueryCost(query, currentNode, maxQueryCost) > maxQueryCost)
+        {
+            ++queryMetrics.rejected;
+            *fcgiOut << QUERY_REJECTED_HEADER << JSON_HEADER << END_HEADERS 
+                     << "{ \"error\" : \"Query too expensive\" }";
+            return;
+        }
+
+        // ok, we have a jsonpath (starting with '$') or a jmespath
+        try 
+        {
+            compiled = CompileQuery(query);
+        }
+        catch(const jsoncons::jsonpath::jsonpath_error &e)
+        {
+            *fcgiErr << e.what();
+            *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+            return;
+        }
+        catch(const jsoncons::jmespath::jmespath_error &e)
+        {
+            *fcgiErr << e.what();
+            *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+            return;
+        }
+
+        // Equality filters on an indexed field skip the scan and are done
+        // right here; everything else runs on a snapshot after unlocking.
+        FieldIndex<Json> *index = 0;
+        if(compiled->equalityFilter && currentNode.is_array())
+        {
+            const std::lock_guard<std::mutex> indexLock(indexMutex);
+            index = FindFieldIndex(tokens, compiled->keyPointer);
+            if(index)
+            {
+                const std::vector<size_t> &positions = index->Find(currentNode, compiled->key);
+                buffer = DumpSelection(currentNode, sort.active ? SortedPositions(currentNode, &tokens, sort, &positions) : positions);
+            }
+        }
+
+        if(!index)
+        {
+            snapshot = PinSnapshot(path, version, currentNode);
+            subject  = snapshot ? snapshot.get() : &currentNode;
+        }
+    }
+    if(!subject || snapshot)
+        docLock.unlock();
+
+    QueryLimits limits(queryTimeout, queryBudget);
+    try 
+    {
+        if(subject)
+        {
+            ++queryMetrics.evaluated;
+
+            // Query results and the engines' intermediates are scratch, and
+            // what is built there is charged to the query.
+            LimitsScope charging(&limits);
+            ArenaScope scope(&requestArena);
+
+            // Sorting needs the result as a value; the partitioned
+            // evaluation only hands back its text.
+            if(sort.active || !EvaluatePartitioned(*subject, query, limits, buffer))
+            {
+                Json result = compiled->jsonpath ? compiled->jsonpath->evaluate(*subject)
+                                                 : compiled->jmespath->evaluate(*subject);
+                limits.Check();
+                if(sort.active && result.is_array())
+                    buffer = DumpSelection(result, SortedPositions(result, 0, sort, 0), &limits);
+                else
+                    result.dump(buffer, jsoncons::indenting::indent);
             }
         }
+    }
+    catch(const jsoncons::jsonpath::jsonpath_error &e)
+    {
+        *fcgiErr << e.what();
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
+    catch(const jsoncons::jmespath::jmespath_error &e)
+    {
+        *fcgiErr << e.what();
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
+    catch(const QueryAborted &e)
+    {
+        *fcgiErr << e.what() << " after " << limits.Used() << " units: " << query << std::endl;
+        if(e.reason == QueryAborted::DEADLINE)
+        {
+            ++queryMetrics.timedOut;
+            *fcgiOut << QUERY_TIMEOUT_HEADER << JSON_HEADER << END_HEADERS 
+                     << "{ \"error\" : \"Query deadline exceeded\" }";
+        }
         else
         {
-            std::string buffer;
-            currentNode.dump(buffer, jsoncons::indenting::indent);
-            AddETagFromBuffer(buffer);
-            AddJsonFromBuffer(buffer);
+            ++queryMetrics.overBudget;
+            *fcgiOut << QUERY_REJECTED_HEADER << JSON_HEADER << END_HEADERS 
+                     << "{ \"error\" : \"Query budget exceeded\" }";
         }
+        return;
+    }
+    if(docLock.owns_lock())
+        docLock.unlock();
+
+    std::string etag = GetETag(buffer);
+    {
+        const std::lock_guard<std::shared_mutex> lock(resultMutex);
+        resultCache.Insert(cacheKey, version, buffer, etag);
     }
+    *fcgiOut << "ETag: " << etag << "\r\n";
+    AddJsonFromBuffer(buffer);
 }
 
 
@@ -289,84 +1778,99 @@ void HandleFCGIPost(const char *path, FCGX_Request &req)
 bool HandleFCGIPatch(const char *path, FCGX_Request &req) 
 {
      // Let's get the document 
-    const std::lock_guard<std::recursive_mutex> lock(docMutex);
+    const std::lock_guard<std::shared_mutex> lock(docMutex);
 
     // check the content type:
     std::string contentType(FCGX_GetParam("CONTENT_TYPE", req.envp));
     
     bool isJson           = (contentType == "application/json");
     bool isJsonMergePatch = (contentType == "application/merge-patch+json");
+    bool isJsonPatch      = (contentType == "application/json-patch+json");
 
-    if(!isJson and !isJsonMergePatch) 
+    if(!isJson and !isJsonMergePatch and !isJsonPatch) 
     {
         // RETURN PARSE ERROR HEADERS.
-        std::cerr << std::string("PATCH Input is neither json or merge-patch json but ") + contentType;
-        std::cout << INCORRECT_PATCH_MEDIA_TYPE << END_HEADERS;
+        *fcgiErr << std::string("PATCH Input is neither json, merge-patch or json-patch json but ") + contentType;
+        *fcgiOut << INCORRECT_PATCH_MEDIA_TYPE << END_HEADERS;
         return false;
     }
 
-    jsoncons::json incoming;
+    // The body is parsed into the request arena; whatever is committed from
+    // it below is copied into the document, never moved.
+    Json incoming;
 
     try 
     {
-        incoming = jsoncons::json::parse(std::cin);
+        ArenaScope scope(&requestArena);
+        incoming = Json::parse(*fcgiIn);
     }
     catch(const jsoncons::ser_error& e) 
     {
-        std::cout << CLIENT_ERROR_HEADER << END_HEADERS;
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
         std::stringstream oss;
         oss << "Parse errors in the data json file at line: " << e.line() << " col: " << e.column() 
                 << ", category: " <<e.code().category().name() 
                 << ", code: " << e.code().value() 
                 << " and message " << e.what() << std::endl;
-        std::cerr << oss.str();
+        *fcgiErr << oss.str();
         return false;
     }
 
     std::error_code ec;
-    jsoncons::json& currentNode = jsoncons::jsonpointer::get(jdoc, path, ec);
+    std::vector<std::string> tokens = PointerTokens(path);
+    Json& currentNode = jsoncons::jsonpointer::get(jdoc, path, ec);
+
+    // Mid-air collision prevention:
+    if(!PreconditionsHold(req, ec ? std::string() : VersionETag(tokens), false))
+        return false;
+
     if (ec)
     {
-        std::cout << NOT_FOUND_HEADER << END_HEADERS;            
+        *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;            
         return false;    
     }
-    
-    // Mid-air collision prevention:
-    const char *http_if_match = FCGX_GetParam("HTTP_IF_MATCH", req.envp);    
-    if(http_if_match) 
-    {
-        // the client wants us to verify that this has not changed...
-        std::string buffer;
-        currentNode.dump(buffer, jsoncons::indenting::indent);
-        
-        std::string etag = GetETag(buffer);
-        
-        if(std::string(http_if_match) != etag)
-        {
-            std::cout << PRECONDITION_FAILED_HEADER << END_HEADERS;
-            return false;
-        }
-    }
 
     // if the If-Unmodified-Since header is present, we must:
     //   convert the incoming header to a time_point 
     //   reject with 412 Precondition Failed if our modified time is newer.
     //   NOTE: the modified timestamp is not granular - it is for the whole store.
     
-    if(isJsonMergePatch) 
+    if(isJsonPatch)
+    {
+        if(!incoming.is_array())
+        {
+            *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
+            return false;
+        }
+
+        // The whole batch is applied under this one lock; on the first
+        // failing operation jsoncons unwinds the ones before it, so the node
+        // is either fully patched or as it was. The unwind may still have
+        // moved values around, so the write is noted either way.
+        jsoncons::jsonpatch::apply_patch(currentNode, incoming, ec);
+        if(ec)
+        {
+            NoteWrite(tokens, WRITE_CHANGED);
+            *fcgiErr << "JSON Patch to " << path << " failed: " << ec.message() << std::endl;
+            *fcgiOut << CONFLICT_HEADER << END_HEADERS;
+            return false;
+        }
+    }
+    else if(isJsonMergePatch) 
         jsoncons::mergepatch::apply_merge_patch(currentNode, incoming);                
     else
-        currentNode.swap(incoming);    
+        currentNode = incoming;    
     
+    NoteWrite(tokens, WRITE_CHANGED);
     lastModified =  local_clock::now();
     
     AddLastModifiedHeader();
     
-    const jsoncons::json& updated = jsoncons::jsonpointer::get(jdoc, path);
+    const Json& updated = jsoncons::jsonpointer::get(jdoc, path);
 
     std::string buffer;
     updated.dump(buffer, jsoncons::indenting::indent);
-    AddETagFromBuffer(buffer);
+    *fcgiOut << "ETag: " << VersionETag(tokens) << "\r\n";
     AddJsonFromBuffer(buffer);
 
     return jsettings["alwayssave"].as_bool();
@@ -377,7 +1881,7 @@ bool HandleFCGIPatch(const char *path, FCGX_Request &req)
 bool HandleFCGIPut(const char *path, FCGX_Request &req) 
 {
     // Let's get the document 
-    const std::lock_guard<std::recursive_mutex> lock(docMutex);
+    const std::lock_guard<std::shared_mutex> lock(docMutex);
     
     // check the content type:
     std::string contentType(FCGX_GetParam("CONTENT_TYPE", req.envp));    
@@ -388,31 +1892,38 @@ bool HandleFCGIPut(const char *path, FCGX_Request &req)
         // RETURN PARSE ERROR HEADERS.
         std::stringstream oss;
         oss << "PUT Input is not json but '" << contentType << "'";
-        std::cerr << oss.str();
-        std::cout << INCORRECT_PATCH_MEDIA_TYPE << END_HEADERS;
+        *fcgiErr << oss.str();
+        *fcgiOut << INCORRECT_PATCH_MEDIA_TYPE << END_HEADERS;
         return false;
     }
 
-    jsoncons::json incoming;
+    // Parsed into the request arena and copied into the document below.
+    Json incoming;
 
     try 
     {
-        incoming = jsoncons::json::parse(std::cin);
+        ArenaScope scope(&requestArena);
+        incoming = Json::parse(*fcgiIn);
     }
     catch(const jsoncons::ser_error& e) 
     {
-        std::cout << CLIENT_ERROR_HEADER << END_HEADERS;
+        *fcgiOut << CLIENT_ERROR_HEADER << END_HEADERS;
         std::stringstream oss;    
     
         oss << "Parse errors in the incoming json at line: " << e.line() << " col: " << e.column() 
                 << ", category: " <<e.code().category().name() 
                 << ", code: " << e.code().value() 
                 << " and message " << e.what() << std::endl;            
-        std::cerr << oss.str();
+        *fcgiErr << oss.str();
         return false;
     }
     
     std::error_code ec;
+    jsoncons::jsonpointer::get(jdoc, path, ec);
+    if(!PreconditionsHold(req, ec ? std::string() : VersionETag(PointerTokens(path)), false))
+        return false;
+
+    ec.clear();
     if(std::string(path) == "") 
     {
         jdoc = incoming;
@@ -429,11 +1940,25 @@ bool HandleFCGIPut(const char *path, FCGX_Request &req)
                 << ", category: " <<ec.category().name() 
                 << ", code: " << ec.value() 
                 << ", message " << ec.message() << std::endl;          
-        std::cerr << oss.str();
-        std::cout << NOT_FOUND_HEADER << END_HEADERS;            
+        *fcgiErr << oss.str();
+        *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;            
         return false;
     }
 
+    // Adding to an array inserts; "-" stands for the new last element.
+    std::vector<std::string> tokens = PointerTokens(path);
+    WriteKind kind = WRITE_CHANGED;
+    if(!tokens.empty())
+    {
+        const Json &parent = jsoncons::jsonpointer::get(jdoc, PointerFromTokens(tokens, tokens.size() - 1), ec);
+        if(!ec && parent.is_array())
+        {
+            kind = WRITE_INSERTED;
+            if(tokens.back() == "-")
+                tokens.back() = std::to_string(parent.size() - 1);
+        }
+    }
+    NoteWrite(tokens, kind);
     
     lastModified =  local_clock::now();
 
@@ -441,7 +1966,7 @@ bool HandleFCGIPut(const char *path, FCGX_Request &req)
     
     std::string buffer;
     incoming.dump(buffer, jsoncons::indenting::indent);
-    AddETagFromBuffer(buffer);
+    *fcgiOut << "ETag: " << VersionETag(tokens) << "\r\n";
     AddJsonFromBuffer(buffer);
 
     return jsettings["alwayssave"].as_bool();
@@ -452,20 +1977,35 @@ bool HandleFCGIPut(const char *path, FCGX_Request &req)
 bool HandleFCGIDelete(const char *path, FCGX_Request &req)
 {
     // Let's get the document 
-    const std::lock_guard<std::recursive_mutex> lock(docMutex);
+    const std::lock_guard<std::shared_mutex> lock(docMutex);
     
     std::error_code ec;
+    jsoncons::jsonpointer::get(jdoc, path, ec);
+    if(!PreconditionsHold(req, ec ? std::string() : VersionETag(PointerTokens(path)), false))
+        return false;
+
+    ec.clear();
     jsoncons::jsonpointer::remove(jdoc, path, ec);
     if (ec)
     {
-        std::cout << NOT_FOUND_HEADER << END_HEADERS;
+        *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;
         return false;
     }
+
+    std::vector<std::string> tokens = PointerTokens(path);
+    WriteKind kind = WRITE_CHANGED;
+    if(!tokens.empty())
+    {
+        const Json &parent = jsoncons::jsonpointer::get(jdoc, PointerFromTokens(tokens, tokens.size() - 1), ec);
+        if(!ec && parent.is_array())
+            kind = WRITE_REMOVED;
+    }
+    NoteWrite(tokens, kind);
   
     lastModified =  local_clock::now();
 
     AddLastModifiedHeader();
-    std::cout << JSON_HEADER << END_HEADERS << "true" << std::endl;
+    *fcgiOut << JSON_HEADER << END_HEADERS << "true" << std::endl;
 
     return jsettings["alwayssave"].as_bool();
 }
@@ -475,97 +2015,221 @@ bool HandleFCGIDelete(const char *path, FCGX_Request &req)
 void HandleFCGIHead(const char *path, FCGX_Request &req)
 {
     // let's get the document 
-    const std::lock_guard<std::recursive_mutex> lock(docMutex);
+    const std::shared_lock<std::shared_mutex> lock(docMutex);
     AddLastModifiedHeader();
 
-    // Using error codes to report errors
+    // Using error codes to report errors; the ETag needs no serialization.
     std::error_code ec;
-    const jsoncons::json& currentNode = jsoncons::jsonpointer::get(jdoc, path, ec);
+    jsoncons::jsonpointer::get(jdoc, path, ec);
+    std::string etag = ec ? std::string() : VersionETag(PointerTokens(path));
+    if(!PreconditionsHold(req, etag, true))
+        return;
     if(ec)
     {
-        std::cout << NOT_FOUND_HEADER << END_HEADERS;
+        *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;
         return;
     }
 
-    std::string buffer;
-    currentNode.dump(buffer, jsoncons::indenting::indent);
-    AddETagFromBuffer(buffer);
-    std::cout << CONTENT_DISPOSITION_HEADER << JSON_HEADER << END_HEADERS;        
+    *fcgiOut << "ETag: " << etag << "\r\n";
+    *fcgiOut << CONTENT_DISPOSITION_HEADER << JSON_HEADER << END_HEADERS;        
 }
 
 // -----------------------------------------------------------------------------
 
-extern "C" void sighandler(int sig_no)
-{   
-    switch(sig_no) {
-        case SIGHUP: 
-            SerializeToFile();
-            break;
-        case SIGINT:
-        case SIGTERM:
-            powerSwitch = 0;    
-            FCGX_ShutdownPending();
-            break;
+// Administrative requests live under ADMIN_PATH:
+//   GET /_admin/stats   reports the cache counters and query limit metrics.
+
+void HandleFCGIAdmin(const std::string &command, const std::string &method, FCGX_Request &req)
+{
+    if(command == "/stats" && method == "GET")
+    {
+        // Writers update views under docMutex, which comes before the
+        // cache locks below.
+        std::stringstream viewStats;
+        {
+            const std::shared_lock<std::shared_mutex> docLock(docMutex);
+            const std::lock_guard<std::mutex> viewLock(viewMutex);
+            const char *separator = " ";
+            for(const auto &entry : views)
+            {
+                viewStats << separator << "\"" << entry.first << "\" : { \"deltas\" : " << entry.second.deltas
+                          << ", \"recomputes\" : " << entry.second.recomputes << " }";
+                separator = ", ";
+            }
+        }
+
+        const std::lock_guard<std::mutex> lock(queryCacheMutex);
+        size_t lookups = queryCache.Hits() + queryCache.Misses();
+        double hitRate = lookups ? double(queryCache.Hits()) / lookups : 0.0;
+        *fcgiOut << JSON_HEADER << END_HEADERS
+                 << "{ \"querycache\" : { \"size\" : " << queryCache.Size()
+                 << ", \"capacity\" : " << queryCache.Capacity()
+                 << ", \"hits\" : " << queryCache.Hits()
+                 << ", \"misses\" : " << queryCache.Misses()
+                 << ", \"hitrate\" : " << hitRate << " }";
+
+        const std::shared_lock<std::shared_mutex> resultLock(resultMutex);
+        lookups = resultCache.Hits() + resultCache.Misses();
+        hitRate = lookups ? double(resultCache.Hits()) / lookups : 0.0;
+        *fcgiOut << ", \"resultcache\" : { \"size\" : " << resultCache.Size()
+                 << ", \"capacity\" : " << resultCache.Capacity()
+                 << ", \"hits\" : " << resultCache.Hits()
+                 << ", \"misses\" : " << resultCache.Misses()
+                 << ", \"hitrate\" : " << hitRate
+                 << ", \"version\" : " << pathVersions.Current() << " }";
+
+        *fcgiOut << ", \"queries\" : { \"evaluated\" : " << queryMetrics.evaluated.load()
+                 << ", \"rejected\" : " << queryMetrics.rejected.load()
+                 << ", \"timedout\" : " << queryMetrics.timedOut.load()
+                 << ", \"overbudget\" : " << queryMetrics.overBudget.load() << " }"
+                 << ", \"views\" : {" << viewStats.str() << " } }";
+        return;
     }
+    *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;
 }
 
-
 // -----------------------------------------------------------------------------
 
-int main(int argc, char **argv)
+// Serves a view from its serialized result, recomputing or reserializing it
+// first if writes got ahead of it. If-Match and If-None-Match are evaluated
+// against the view's ETag as for GET.
+
+void HandleFCGIView(const std::string &name, const std::string &method, FCGX_Request &req)
 {
+    if(method != "GET" && method != "HEAD")
+    {
+        *fcgiOut << METHOD_ERROR_HEADER << JSON_HEADER << END_HEADERS << METHOD_ERROR_BODY;
+        return;
+    }
 
-    std::string configfile = argc == 2 ? argv[1] : "/etc/beerbelly.json";
+    const std::shared_lock<std::shared_mutex> lock(docMutex);
+    const std::lock_guard<std::mutex> viewLock(viewMutex);
 
-    ReadSettingsFromFile(configfile);
+    auto entry = views.find(name);
+    if(entry == views.end())
+    {
+        *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;
+        return;
+    }
 
-    std::ofstream pidfile;
-    pidfile.open(jsettings["pidfile"].as_string());
-    pidfile << getpid();
-    pidfile.close();
+    MaterializedView &view = entry->second;
+    try 
+    {
+        if(view.stale && !RecomputeView(view))
+        {
+            *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;
+            return;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        *fcgiErr << "View " << name << " failed: " << e.what() << std::endl;
+        *fcgiOut << NOT_FOUND_HEADER << END_HEADERS;
+        return;
+    }
 
-    struct sigaction new_action, old_action;    
-    new_action.sa_handler = sighandler;
-    sigemptyset(&new_action.sa_mask);
-    new_action.sa_flags = 0;
-    sigaction(SIGINT, &new_action, &old_action);
-    sigaction(SIGTERM, &new_action, &old_action);
-    sigaction(SIGHUP, &new_action, &old_action);
+    if(view.dirty)
+    {
+        view.body.clear();
+        if(view.kind == MaterializedView::AGGREGATE)
+        {
+            ArenaScope scope(&requestArena);
+            view.aggregation->Result().dump(view.body, jsoncons::indenting::indent);
+        }
+        else
+            view.rows.dump(view.body, jsoncons::indenting::indent);
+        view.etag  = GetETag(view.body);
+        view.dirty = false;
+    }
 
-    UnSerializeFromFile(); 
+    AddLastModifiedHeader();
+    if(!PreconditionsHold(req, view.etag, true))
+        return;
+    *fcgiOut << "ETag: " << view.etag << "\r\n";
 
-    std::streambuf * cin_streambuf  = std::cin.rdbuf();
-    std::streambuf * cout_streambuf = std::cout.rdbuf();
-    std::streambuf * cerr_streambuf = std::cerr.rdbuf();
+    if(method == "HEAD")
+        *fcgiOut << CONTENT_DISPOSITION_HEADER << JSON_HEADER << END_HEADERS;
+    else
+        AddJsonFromBuffer(view.body);
+}
 
-    FCGX_Request request;
-    int res = 0;
+// -----------------------------------------------------------------------------
 
-    if((res = FCGX_Init()) != 0)
-        std::cerr << "FCGX_Init fail: " << res << std::endl;
+// Signals are blocked in every thread and taken here instead, where it is safe
+// to lock the document. Shutting the socket down wakes the request threads
+// blocked in accept.
 
-    umask(0);
-    int sock = FCGX_OpenSocket(jsettings["port"].as_string().c_str(), 128);
+void HandleSignals(sigset_t signals, int sock)
+{
+    for(;;)
+    {
+        int sig_no = 0;
+        if(sigwait(&signals, &sig_no) != 0)
+            continue;
+
+        switch(sig_no) {
+            case SIGHUP: 
+                SerializeToFile();
+                break;
+            case SIGINT:
+            case SIGTERM:
+                powerSwitch = 0;    
+                FCGX_ShutdownPending();
+                shutdown(sock, SHUT_RDWR);
+                return;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// A request thread: accepts requests on 'sock' and answers them until the
+// daemon shuts down.
+
+void ServeRequests(int sock)
+{
+    FCGX_Request request;
+    int res = 0;
 
     if((res = FCGX_InitRequest(&request, sock, 0)) != 0)
+    {
         std::cerr << "FCGX_InitRequest fail: " << res << std::endl;
+        return;
+    }
 
-    while ((res = FCGX_Accept_r(&request)) == 0 && powerSwitch) 
+    for(;;)
     {
+        {
+            const std::lock_guard<std::mutex> lock(acceptMutex);
+            res = FCGX_Accept_r(&request);
+        }
+        if(res != 0 || !powerSwitch)
+            break;
+
         fcgi_streambuf cin_fcgi_streambuf(request.in);
         fcgi_streambuf cout_fcgi_streambuf(request.out);
         fcgi_streambuf cerr_fcgi_streambuf(request.err);
 
-        std::cin.rdbuf(&cin_fcgi_streambuf);
-        std::cout.rdbuf(&cout_fcgi_streambuf);
-        std::cerr.rdbuf(&cerr_fcgi_streambuf);
+        std::istream in(&cin_fcgi_streambuf);
+        std::ostream out(&cout_fcgi_streambuf);
+        std::ostream err(&cerr_fcgi_streambuf);
+
+        fcgiIn  = &in;
+        fcgiOut = &out;
+        fcgiErr = &err;
 
         char *pi = FCGX_GetParam("PATH_INFO", request.envp);
         std::string method(FCGX_GetParam("REQUEST_METHOD", request.envp));
 
+        std::string pathInfo(pi ? pi : "");
+
         bool save = false;
 
-        if     (method == "GET"   )  HandleFCGIGet(pi, request);
+        if(pathInfo == ADMIN_PATH || pathInfo.compare(0, ADMIN_PATH.size() + 1, ADMIN_PATH + "/") == 0)  
+            HandleFCGIAdmin(pathInfo.substr(ADMIN_PATH.size()), method, request);
+        else if(pathInfo.compare(0, VIEWS_PATH.size() + 1, VIEWS_PATH + "/") == 0)  
+            HandleFCGIView(pathInfo.substr(VIEWS_PATH.size() + 1), method, request);
+        else if(method == "GET"   )  HandleFCGIGet(pi, request);
         else if(method == "PATCH" )  save = HandleFCGIPatch(pi, request);
         else if(method == "PUT"   )  save = HandleFCGIPut(pi, request);                    
         else if(method == "DELETE")  save = HandleFCGIDelete(pi, request);
@@ -573,26 +2237,107 @@ int main(int argc, char **argv)
         else if(method == "POST"  )  HandleFCGIPost(pi, request);
         else  
         {
-            std::cout << METHOD_ERROR_HEADER << JSON_HEADER << END_HEADERS << METHOD_ERROR_BODY;
+            out << METHOD_ERROR_HEADER << JSON_HEADER << END_HEADERS << METHOD_ERROR_BODY;
             std::stringstream oss;
             oss << "Method " << method << " not allowed from " << std::string(FCGX_GetParam("REMOTE_ADDR", request.envp)) << std::endl;
-            std::cerr << oss.str();
+            err << oss.str();
 
         }
-        
+
+        out.flush();
+        err.flush();
+        fcgiIn  = &std::cin;
+        fcgiOut = &std::cout;
+        fcgiErr = &std::cerr;
+
         FCGX_Finish_r(&request);
 
+        requestArena.Reset();
+        for(auto &arena : partitionArenas)
+            arena->Reset();
+
         if(save)
             SerializeToFile();
     }
-    close(sock);
 
-    // restore stdio streambufs
-    std::cin.rdbuf(cin_streambuf);
-    std::cout.rdbuf(cout_streambuf);
-    std::cerr.rdbuf(cerr_streambuf);
-  
     std::cerr << "FCGI loop exited, res is " << res << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+
+    std::string configfile = argc == 2 ? argv[1] : "/etc/beerbelly.json";
+
+    ReadSettingsFromFile(configfile);
+    LoadFieldIndexes();
+    LoadViews();
+    if(jsettings.contains("querycache"))
+        queryCache.SetCapacity(jsettings["querycache"].as<size_t>());
+    if(jsettings.contains("resultcache"))
+        resultCache.SetCapacity(jsettings["resultcache"].as<size_t>());
+    if(jsettings.contains("parallelthreshold"))
+        parallelThreshold = jsettings["parallelthreshold"].as<size_t>();
+    if(jsettings.contains("querytimeout"))
+        queryTimeout = std::chrono::milliseconds(jsettings["querytimeout"].as<int64_t>());
+    if(jsettings.contains("querybudget"))
+        queryBudget = jsettings["querybudget"].as<uint64_t>();
+    if(jsettings.contains("maxquerycost"))
+        maxQueryCost = jsettings["maxquerycost"].as<double>();
+    if(jsettings.contains("snapshotcache"))
+        snapshotCache.SetCapacity(jsettings["snapshotcache"].as<size_t>());
+    if(jsettings.contains("snapshotmin"))
+        snapshotMin = jsettings["snapshotmin"].as<size_t>();
+
+    // Block the signals before any thread starts so that they all inherit
+    // the mask and only the signal thread takes them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+    // The calling thread works on a partition too.
+    size_t hardware = std::thread::hardware_concurrency();
+    workerPool.Resize(jsettings.contains("workers") ? jsettings["workers"].as<size_t>() 
+                                                    : (hardware > 1 ? hardware - 1 : 0));
+
+    std::ofstream pidfile;
+    pidfile.open(jsettings["pidfile"].as_string());
+    pidfile << getpid();
+    pidfile.close();
+
+    // Versions start over with every run; the epoch keeps their ETags apart.
+    epoch = std::chrono::duration_cast<std::chrono::microseconds>(local_clock::now().time_since_epoch()).count();
+
+    UnSerializeFromFile(); 
+
+    int res = 0;
+
+    if((res = FCGX_Init()) != 0)
+        std::cerr << "FCGX_Init fail: " << res << std::endl;
+
+    umask(0);
+    int sock = FCGX_OpenSocket(jsettings["port"].as_string().c_str(), 128);
+
+    std::thread signalThread(HandleSignals, signals, sock);
+
+    size_t threads = jsettings.contains("threads") ? jsettings["threads"].as<size_t>() : DEFAULT_REQUEST_THREADS;
+    std::vector<std::thread> requestThreads;
+    for(size_t i = 0; i < std::max<size_t>(threads, 1); ++i)
+        requestThreads.emplace_back(ServeRequests, sock);
+    for(std::thread &thread : requestThreads)
+        thread.join();
+
+    // The request threads can also stop on a failing socket; wake the
+    // signal thread in that case.
+    if(powerSwitch)
+        pthread_kill(signalThread.native_handle(), SIGTERM);
+    signalThread.join();
+
+    close(sock);
 
     SerializeToFile();
     
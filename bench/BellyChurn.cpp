@@ -0,0 +1,105 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BellyAllocator.h"
+
+// -----------------------------------------------------------------------------
+// Allocation churn of beerbelly's long-lived values: every thread keeps
+// replacing blocks in a table of live blocks, with sizes mostly those of
+// strings and small member vectors and now and then a large array. One
+// replacement in eight lands in the part of the table of the next thread, so
+// that block is freed on another thread than the one it came from, as when a
+// request thread overwrites a value another one wrote. Reports millions of
+// replacements a second for BellyAllocate and for malloc, from one thread up.
+//
+//     belly-churn [max threads] [replacements per thread]
+// -----------------------------------------------------------------------------
+
+static const size_t BLOCKS_PER_THREAD = 4096;
+
+struct Malloc
+{
+    static const char *Name() { return "malloc"; }
+    static void *Allocate(size_t size) { return std::malloc(size); }
+    static void  Deallocate(void *ptr) { std::free(ptr); }
+};
+
+struct Belly
+{
+    static const char *Name() { return "belly"; }
+    static void *Allocate(size_t size) { return BellyAllocate(size); }
+    static void  Deallocate(void *ptr) { BellyDeallocate(ptr); }
+};
+
+// -----------------------------------------------------------------------------
+
+size_t RandomSize(std::mt19937 &random)
+{
+    unsigned pick = random() % 100;
+    if(pick < 80)
+        return 16 + random() % 112;
+    if(pick < 98)
+        return 128 + random() % 3968;
+    return 4096 + random() % 61440;
+}
+
+// -----------------------------------------------------------------------------
+
+template <class Allocator>
+double Churn(size_t threads, size_t replacements)
+{
+    std::vector<std::atomic<void*>> blocks(threads * BLOCKS_PER_THREAD);
+    for(std::atomic<void*> &block : blocks)
+        block = 0;
+
+    auto work = [&](size_t thread)
+    {
+        std::mt19937 random((unsigned)thread + 1);
+        for(size_t i = 0; i < replacements; ++i)
+        {
+            size_t owner = random() % 8 == 0 ? (thread + 1) % threads : thread;
+            size_t slot  = owner * BLOCKS_PER_THREAD + random() % BLOCKS_PER_THREAD;
+
+            size_t size = RandomSize(random);
+            char *fresh = static_cast<char*>(Allocator::Allocate(size));
+            fresh[0] = fresh[size - 1] = char(i);
+            Allocator::Deallocate(blocks[slot].exchange(fresh));
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for(size_t thread = 0; thread < threads; ++thread)
+        workers.emplace_back(work, thread);
+    for(std::thread &worker : workers)
+        worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for(std::atomic<void*> &block : blocks)
+        Allocator::Deallocate(block.load());
+    return threads * replacements / elapsed.count() / 1e6;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    size_t hardware     = std::thread::hardware_concurrency();
+    size_t maxThreads   = argc > 1 ? std::stoul(argv[1]) : (hardware ? hardware : 4);
+    size_t replacements = argc > 2 ? std::stoul(argv[2]) : 2000000;
+
+    std::cout << "threads\tbelly Mops/s\tmalloc Mops/s" << std::endl;
+    for(size_t threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        double belly  = Churn<Belly>(threads, replacements);
+        double system = Churn<Malloc>(threads, replacements);
+        std::cout << threads << '\t' << belly << '\t' << system << std::endl;
+    }
+    return 0;
+}
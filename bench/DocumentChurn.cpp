@@ -0,0 +1,82 @@
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "rapidjson/document.h"
+#include "rapidjson/pointer.h"
+
+#include "SlabAllocator.h"
+
+// -----------------------------------------------------------------------------
+// The churn of a document kept up to date with PUTs and DELETEs: random PUTs
+// of small records to "/records/<id>" and DELETEs of them, over a fixed set
+// of ids, applied the way holdmybeer applies them, by parsing the body into a
+// document of the same allocator and moving it into place. Reports the
+// operations a second, the bytes the allocator holds and the peak RSS, for
+// the allocator named on the command line; run it once with each to compare,
+// as RSS only ever grows within a process.
+//
+//     document-churn pool|slab [operations] [ids]
+//
+// The pool is measured without the compaction holdmybeer runs between
+// requests, to show what compaction has to make up for.
+// -----------------------------------------------------------------------------
+
+template <class Allocator>
+void Churn(size_t operations, size_t ids)
+{
+    typedef rapidjson::GenericDocument<rapidjson::UTF8<>, Allocator> Document;
+    typedef rapidjson::GenericPointer<typename Document::ValueType> Pointer;
+
+    Document doc;
+    doc.Parse("{\"records\":{}}");
+
+    std::mt19937 random(1);
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < operations; ++i)
+    {
+        Pointer pointer(("/records/" + std::to_string(random() % ids)).c_str());
+        if(random() % 2)
+        {
+            std::string body = "{\"name\":\"user" + std::to_string(i) + "\",\"visits\":" + std::to_string(random() % 1000)
+                             + ",\"tags\":[\"" + std::string(random() % 64, 'x') + "\",\"b\",\"c\"],\"seen\":"
+                             + std::to_string(i) + "}";
+            Document value(&doc.GetAllocator());
+            value.Parse(body.c_str());
+            pointer.Set(doc, value.Move());
+        }
+        else
+            pointer.Erase(doc);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::cout << operations / elapsed.count() << " operations/s, "
+              << doc["records"].MemberCount() << " records, "
+              << doc.GetAllocator().Size() << " bytes used, "
+              << usage.ru_maxrss << " KiB peak RSS" << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2 || (std::strcmp(argv[1], "pool") && std::strcmp(argv[1], "slab")))
+    {
+        std::cerr << "usage: document-churn pool|slab [operations] [ids]" << std::endl;
+        return 1;
+    }
+    size_t operations = argc > 2 ? std::stoul(argv[2]) : 1000000;
+    size_t ids        = argc > 3 ? std::stoul(argv[3]) : 1000;
+
+    if(!std::strcmp(argv[1], "pool"))
+        Churn<rapidjson::MemoryPoolAllocator<>>(operations, ids);
+    else
+        Churn<SlabAllocator>(operations, ids);
+    return 0;
+}
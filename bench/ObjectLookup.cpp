@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rapidjson/document.h"
+
+#include "ObjectIndex.h"
+
+// -----------------------------------------------------------------------------
+// Member lookups in objects of growing size, by name, as JSON Pointer
+// resolution does them: with rapidjson's linear FindMember and through an
+// ObjectIndex hash table. Reports nanoseconds per lookup for each size; the
+// index table is built by the first lookup and not counted.
+//
+//     object-lookup [largest size]
+// -----------------------------------------------------------------------------
+
+typedef rapidjson::Document::ValueType Value;
+
+// -----------------------------------------------------------------------------
+
+template <class Find>
+double NanosPerLookup(const std::vector<std::string> &names, size_t lookups, const Find &find)
+{
+    std::mt19937 random(1);
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; ++i)
+        found += find(names[random() % names.size()]);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    if(found != lookups)
+        std::cerr << "missed " << lookups - found << " lookups" << std::endl;
+    return elapsed.count() / lookups;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    size_t largest = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+    std::cout << "members\tscan ns\tindex ns" << std::endl;
+    for(size_t size = 10; size <= largest; size *= 10)
+    {
+        rapidjson::Document doc;
+        doc.SetObject();
+        std::vector<std::string> names;
+        for(size_t i = 0; i < size; ++i)
+        {
+            names.push_back("session-" + std::to_string(i * 7919));
+            Value name(names.back().c_str(), (rapidjson::SizeType)names.back().size(), doc.GetAllocator());
+            doc.AddMember(name, Value((uint64_t)i), doc.GetAllocator());
+        }
+
+        // Fewer scans of the big objects, so every size takes about as long.
+        size_t lookups = std::max<size_t>(1000, std::min<size_t>(1000000, 100000000 / size));
+
+        double scan = NanosPerLookup(names, lookups, [&](const std::string &name)
+        {
+            Value key(rapidjson::StringRef(name.c_str(), name.size()));
+            return doc.FindMember(key) != doc.MemberEnd();
+        });
+
+        ObjectIndex<Value> index;
+        index.SetThreshold(1);
+        index.FindMember(doc, names[0].c_str(), (rapidjson::SizeType)names[0].size());
+        double indexed = NanosPerLookup(names, lookups, [&](const std::string &name)
+        {
+            return index.FindMember(doc, name.c_str(), (rapidjson::SizeType)name.size()) != doc.MemberEnd();
+        });
+
+        std::cout << size << '\t' << scan << '\t' << indexed << std::endl;
+    }
+    return 0;
+}
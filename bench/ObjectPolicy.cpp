@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <jsoncons/json.hpp>
+
+// -----------------------------------------------------------------------------
+// The two object policies beerbelly can be built with (BEERBELLY_OBJECT_POLICY
+// in CMakeLists.txt) under an insert-heavy and a lookup-heavy workload: an
+// object filled one member at a time in random name order, as PUTs to new
+// keys fill it, and random lookups by name in the filled object. Reports
+// nanoseconds per insert and per lookup for each policy and object size.
+//
+//     object-policy [largest size]
+// -----------------------------------------------------------------------------
+
+template <class Policy>
+void Measure(const char *name, const std::vector<std::string> &names)
+{
+    typedef jsoncons::basic_json<char, Policy> Json;
+
+    std::vector<std::string> order(names);
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+    Json object(jsoncons::json_object_arg);
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < order.size(); ++i)
+        object.insert_or_assign(order[i], i);
+    std::chrono::duration<double, std::nano> inserting = std::chrono::steady_clock::now() - start;
+
+    // Fewer lookups in the big objects, so every size takes about as long.
+    size_t lookups = std::max<size_t>(1000, std::min<size_t>(1000000, 100000000 / names.size()));
+
+    std::mt19937 random(2);
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; ++i)
+        found += object.contains(names[random() % names.size()]);
+    std::chrono::duration<double, std::nano> looking = std::chrono::steady_clock::now() - start;
+
+    if(found != lookups)
+        std::cerr << "missed " << lookups - found << " lookups" << std::endl;
+    std::cout << name << '\t' << names.size() << '\t' << inserting.count() / names.size()
+              << '\t' << looking.count() / lookups << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    size_t largest = argc > 1 ? std::stoul(argv[1]) : 64000;
+
+    std::cout << "policy\tmembers\tinsert ns\tlookup ns" << std::endl;
+    for(size_t size = 1000; size <= largest; size *= 4)
+    {
+        std::vector<std::string> names;
+        for(size_t i = 0; i < size; ++i)
+            names.push_back("session-" + std::to_string(i * 7919));
+
+        Measure<jsoncons::sorted_policy>("sorted", names);
+        Measure<jsoncons::order_preserving_policy>("ordered", names);
+    }
+    return 0;
+}
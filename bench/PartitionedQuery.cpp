@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <jsoncons/json.hpp>
+#include <jsoncons_ext/jsonpath/jsonpath.hpp>
+#include <jsoncons_ext/jmespath/jmespath.hpp>
+
+#include "BellyAllocator.h"
+#include "PartitionedQuery.h"
+#include "WorkerPool.h"
+
+// -----------------------------------------------------------------------------
+// Scaling of split element-wise queries: a JSONPath filter and a JMESPath
+// projection over a large array, evaluated whole and then in slices of 8192
+// elements on one thread up to the number of cores, with an arena per thread
+// as beerbelly does. Reports milliseconds per query and the speedup over the
+// whole evaluation, and checks that every split result equals the whole one.
+//
+//     partitioned-query [elements] [max threads]
+// -----------------------------------------------------------------------------
+
+typedef jsoncons::basic_json<char, jsoncons::sorted_policy, BellyAllocator<char>> Json;
+
+static const size_t PARTITION_SIZE = 8192;
+
+// -----------------------------------------------------------------------------
+
+Json Evaluate(const std::string &query, const Json &node)
+{
+    if(query.at(0) == '$')
+        return jsoncons::jsonpath::make_expression<Json>(query).evaluate(node);
+    return jsoncons::jmespath::make_expression<Json>(query).evaluate(node);
+}
+
+// -----------------------------------------------------------------------------
+
+Json MakeArray(size_t count)
+{
+    Json items(jsoncons::json_array_arg);
+    items.reserve(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        Json item(jsoncons::json_object_arg);
+        item["Id"]       = i;
+        item["Customer"] = "customer" + std::to_string(i % 1000);
+        item["Quantity"] = i % 10;
+        item["Price"]    = (i % 997) / 10.0;
+        items.push_back(std::move(item));
+    }
+    return items;
+}
+
+// -----------------------------------------------------------------------------
+
+// Runs 'query' over 'array' on 'threads' threads, or whole when 'threads' is
+// zero, and returns the milliseconds it took; 'dump' gets the result.
+
+double Run(const std::string &query, const Json &array, size_t threads, WorkerPool &pool,
+           std::vector<std::unique_ptr<RequestArena>> &arenas, std::string &dump)
+{
+    auto start = std::chrono::steady_clock::now();
+    {
+        Json result;
+        if(!threads)
+        {
+            ArenaScope scope(arenas[0].get());
+            result = Evaluate(query, array);
+            dump.clear();
+            result.dump(dump);
+        }
+        else
+        {
+            std::vector<std::string> prefix;
+            std::string elementwise;
+            SplitElementwiseQuery(query, prefix, elementwise);
+
+            pool.Resize(threads - 1);
+            size_t parts = std::max((array.size() + PARTITION_SIZE - 1) / PARTITION_SIZE, threads);
+
+            auto evaluate = [&](size_t begin, size_t end, size_t slot) -> Json
+            {
+                ArenaScope scope(arenas[slot].get());
+                Json slice = SliceOf(array, begin, end);
+                return Evaluate(elementwise, slice);
+            };
+
+            EvaluateInParts(array, parts, threads > 1 ? &pool : 0, evaluate, result);
+            dump.clear();
+            result.dump(dump);
+        }
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    // The results are gone; their arena blocks can be reused.
+    for(std::unique_ptr<RequestArena> &arena : arenas)
+        arena->Reset();
+    return elapsed.count();
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    size_t hardware   = std::thread::hardware_concurrency();
+    size_t elements   = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t maxThreads = argc > 2 ? std::stoul(argv[2]) : (hardware ? hardware : 4);
+
+    Json array = MakeArray(elements);
+    WorkerPool pool;
+    std::vector<std::unique_ptr<RequestArena>> arenas;
+    for(size_t slot = 0; slot < maxThreads; ++slot)
+        arenas.emplace_back(new RequestArena);
+
+    int failures = 0;
+    for(const char *query : { "$[?(@.Quantity > 5)]", "[*].{c: Customer, p: Price}" })
+    {
+        std::string whole;
+        double single = Run(query, array, 0, pool, arenas, whole);
+        std::cout << query << std::endl << "whole\t" << single << " ms" << std::endl;
+
+        for(size_t threads = 1; threads <= maxThreads; ++threads)
+        {
+            std::string split;
+            double ms = Run(query, array, threads, pool, arenas, split);
+            std::cout << threads << " threads\t" << ms << " ms\t" << single / ms << "x" << std::endl;
+            if(split != whole)
+            {
+                std::cerr << "FAIL: split result differs on " << threads << " threads" << std::endl;
+                ++failures;
+            }
+        }
+    }
+    return failures ? 1 : 0;
+}
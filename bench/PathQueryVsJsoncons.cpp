@@ -0,0 +1,119 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "rapidjson/document.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+
+#include <jsoncons/json.hpp>
+#include <jsoncons_ext/jsonpath/jsonpath.hpp>
+
+#include "BellyAllocator.h"
+#include "PathQuery.h"
+
+// -----------------------------------------------------------------------------
+// holdmybeer's PathQuery against the jsoncons JSONPath engine beerbelly uses,
+// on the same array of records: each query is compiled once and then run
+// and serialized the way each daemon answers it, holdmybeer streaming the
+// matches into a PrettyWriter and beerbelly building the result in a request
+// arena and dumping it indented. Reports milliseconds per query for each and
+// checks that both find the same number of matches.
+//
+//     path-query [elements] [repetitions]
+// -----------------------------------------------------------------------------
+
+typedef jsoncons::basic_json<char, jsoncons::sorted_policy, BellyAllocator<char>> Json;
+
+// -----------------------------------------------------------------------------
+
+std::string MakeArray(size_t count)
+{
+    std::string text = "[";
+    for(size_t i = 0; i < count; ++i)
+    {
+        text += i ? "," : "";
+        text += "{\"Id\":" + std::to_string(i) + ",\"Customer\":\"customer" + std::to_string(i % 1000)
+              + "\",\"Quantity\":" + std::to_string(i % 10) + ",\"Price\":" + std::to_string((i % 997) / 10.0)
+              + ",\"Tags\":[\"a\",\"b\"]}";
+    }
+    return text + "]";
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    size_t elements    = argc > 1 ? std::stoul(argv[1]) : 100000;
+    size_t repetitions = argc > 2 ? std::stoul(argv[2]) : 20;
+
+    std::string text = MakeArray(elements);
+    rapidjson::Document doc;
+    doc.Parse(text.c_str());
+    Json json = Json::parse(text);
+    RequestArena arena;
+
+    int failures = 0;
+    const char *queries[] =
+    {
+        "$[*].Id",
+        "$[?(@.Quantity >= 5)].Customer",
+        "$[?(@.Customer == 'customer7')]",
+        "$[-100:]",
+        "$[::100].Tags[0]"
+    };
+
+    std::cout << "query\tholdmybeer ms\tbeerbelly ms" << std::endl;
+    for(const char *query : queries)
+    {
+        PathQuery<rapidjson::Document::ValueType> plan;
+        std::string error;
+        if(!plan.Compile(query, error))
+        {
+            std::cerr << "FAIL: " << query << ": " << error << std::endl;
+            ++failures;
+            continue;
+        }
+        auto expression = jsoncons::jsonpath::make_expression<Json>(query);
+
+        size_t matches = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(size_t r = 0; r < repetitions; ++r)
+        {
+            rapidjson::StringBuffer buffer;
+            rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+            matches = 0;
+            writer.StartArray();
+            plan.Evaluate(doc, [&](rapidjson::Document::ValueType &match)
+            {
+                match.Accept(writer);
+                ++matches;
+            });
+            writer.EndArray();
+        }
+        std::chrono::duration<double, std::milli> native = std::chrono::steady_clock::now() - start;
+
+        size_t results = 0;
+        start = std::chrono::steady_clock::now();
+        for(size_t r = 0; r < repetitions; ++r)
+        {
+            {
+                ArenaScope scope(&arena);
+                Json result = expression.evaluate(json);
+                std::string buffer;
+                result.dump(buffer, jsoncons::indenting::indent);
+                results = result.size();
+            }
+            arena.Reset();
+        }
+        std::chrono::duration<double, std::milli> generic = std::chrono::steady_clock::now() - start;
+
+        std::cout << query << '\t' << native.count() / repetitions << '\t' << generic.count() / repetitions << std::endl;
+        if(matches != results)
+        {
+            std::cerr << "FAIL: " << query << " matched " << matches << " against " << results << std::endl;
+            ++failures;
+        }
+    }
+    return failures ? 1 : 0;
+}
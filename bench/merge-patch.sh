@@ -0,0 +1,85 @@
+#!/bin/bash
+#
+# Merge patches on a wide and on a deep document: ROUNDS PATCHes of an object
+# of WIDTH members, each changing a tenth of them and adding and removing
+# one, and ROUNDS PATCHes of an object nested DEPTH levels deep, each setting
+# a member at every level on the way to the leaf and changing the leaf.
+# Reports patches a second for both.
+#
+#     bench/merge-patch.sh [url] [rounds] [width] [depth]
+#
+# The url is that of a running daemon, e.g. http://localhost/holdmybeer. The
+# benchmark writes to /bench in its document. It needs curl and awk, and isn't
+# built by CMake; see Benchmarks in the README for the setup.
+
+URL=${1:-http://localhost/holdmybeer}
+ROUNDS=${2:-200}
+WIDTH=${3:-10000}
+DEPTH=${4:-64}
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+put()
+{
+    curl -s -o /dev/null -X PUT -H 'Content-Type: application/json' -d @"$1" "$URL/bench"
+}
+
+patch()
+{
+    curl -s -o /dev/null -w '%{http_code}\n' -X PATCH -H 'Content-Type: application/merge-patch+json' -d @"$1" "$URL/bench"
+}
+
+# Runs the patches in $OUT/patch.* and reports their rate and statuses.
+run()
+{
+    start=$(date +%s.%N)
+    for ((r = 0; r < ROUNDS; ++r)); do
+        patch "$OUT/patch.$r"
+    done > "$OUT/status"
+    end=$(date +%s.%N)
+
+    echo "$1:"
+    sort "$OUT/status" | uniq -c | sed 's/^ */    /'
+    awk -v n="$ROUNDS" -v start="$start" -v end="$end" 'BEGIN { printf "    %.0f patches/s\n", n / (end - start) }'
+}
+
+awk -v width="$WIDTH" 'BEGIN {
+    printf "{"
+    for(i = 0; i < width; ++i)
+        printf "%s\"m%d\":{\"v\":0,\"s\":\"member %d\"}", i ? "," : "", i, i
+    printf "}"
+}' > "$OUT/document"
+put "$OUT/document"
+
+for ((r = 0; r < ROUNDS; ++r)); do
+    awk -v width="$WIDTH" -v round="$r" 'BEGIN {
+        printf "{\"extra%d\":{\"v\":%d},\"extra%d\":null", round, round, round - 1
+        for(i = round % 10; i < width; i += 10)
+            printf ",\"m%d\":{\"v\":%d}", i, round
+        printf "}"
+    }' > "$OUT/patch.$r"
+done
+run "wide ($WIDTH members)"
+
+awk -v depth="$DEPTH" 'BEGIN {
+    for(i = 0; i < depth; ++i)
+        printf "{\"s\":0,\"n\":"
+    printf "{\"v\":0}"
+    for(i = 0; i < depth; ++i)
+        printf "}"
+}' > "$OUT/document"
+put "$OUT/document"
+
+for ((r = 0; r < ROUNDS; ++r)); do
+    awk -v depth="$DEPTH" -v round="$r" 'BEGIN {
+        for(i = 0; i < depth; ++i)
+            printf "{\"s\":%d,\"n\":", round
+        printf "{\"v\":%d,\"w\":%s}", round, round % 2 ? "null" : "\"set\""
+        for(i = 0; i < depth; ++i)
+            printf "}"
+    }' > "$OUT/patch.$r"
+done
+run "deep ($DEPTH levels)"
+
+curl -s -o /dev/null -X DELETE "$URL/bench"
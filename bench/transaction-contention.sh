@@ -0,0 +1,78 @@
+#!/bin/bash
+#
+# Contention of holdmybeer transactions: CLIENTS clients at once each run
+# ROUNDS transactions that set two neighbouring keys out of KEYS, so that
+# clients keep overlapping. Each transaction first reads the ETags of both
+# keys and makes them its preconditions, the optimistic way, and is either
+# committed or turned down with 412 when another client wrote one of the keys
+# in between. Then the same load is run as atomic "incr" operations, which
+# need no preconditions. Reports the count of each status and transactions a
+# second for both.
+#
+#     bench/transaction-contention.sh [url] [clients] [rounds] [keys]
+#
+# The url is that of a running daemon, e.g. http://localhost/holdmybeer. The
+# benchmark writes to /bench in its document. It needs curl and awk, and isn't
+# built by CMake; see Benchmarks in the README for the setup.
+
+URL=${1:-http://localhost/holdmybeer}
+CLIENTS=${2:-16}
+ROUNDS=${3:-200}
+KEYS=${4:-8}
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# The ETag of a node, with its quotes escaped for a JSON string.
+etag()
+{
+    curl -s -o /dev/null -D - "$URL/bench/counters/$1" | tr -d '\r' | sed -n 's/^[Ee][Tt][Aa][Gg]: *//p' | sed 's/"/\\"/g'
+}
+
+post()
+{
+    curl -s -o /dev/null -w '%{http_code}\n' -X POST -H 'Content-Type: application/transaction+json' -d "$1" "$URL/bench"
+}
+
+optimistic()
+{
+    for ((i = 0; i < ROUNDS; ++i)); do
+        a=k$((RANDOM % KEYS))
+        b=k$(( (${a#k} + 1) % KEYS ))
+        post "{\"preconditions\":[{\"pointer\":\"/counters/$a\",\"etag\":\"$(etag $a)\"},{\"pointer\":\"/counters/$b\",\"etag\":\"$(etag $b)\"}],
+               \"operations\":[{\"op\":\"put\",\"pointer\":\"/counters/$a\",\"value\":$i},{\"op\":\"put\",\"pointer\":\"/counters/$b\",\"value\":$i}]}"
+    done
+}
+
+atomic()
+{
+    for ((i = 0; i < ROUNDS; ++i)); do
+        a=k$((RANDOM % KEYS))
+        b=k$(( (${a#k} + 1) % KEYS ))
+        post "{\"operations\":[{\"op\":\"incr\",\"pointer\":\"/counters/$a\",\"value\":1},{\"op\":\"incr\",\"pointer\":\"/counters/$b\",\"value\":1}]}"
+    done
+}
+
+run()
+{
+    counters=""
+    for ((k = 0; k < KEYS; ++k)); do
+        counters="$counters${counters:+,}\"k$k\":0"
+    done
+    curl -s -o /dev/null -X PUT -H 'Content-Type: application/json' -d "{\"counters\":{$counters}}" "$URL/bench"
+
+    start=$(date +%s.%N)
+    for ((c = 0; c < CLIENTS; ++c)); do
+        $1 > "$OUT/$1.$c" &
+    done
+    wait
+    end=$(date +%s.%N)
+
+    echo "$1:"
+    cat "$OUT/$1".* | sort | uniq -c | sed 's/^ */    /'
+    awk -v n=$((CLIENTS * ROUNDS)) -v start="$start" -v end="$end" 'BEGIN { printf "    %.0f transactions/s\n", n / (end - start) }'
+}
+
+run optimistic
+run atomic
+curl -s -o /dev/null -X DELETE "$URL/bench"
@@ -1,16 +1,22 @@
 #include <unistd.h>
 #include <signal.h>
 #include <cstdlib>
+#include <algorithm>
 #include <utility>
 #include <cctype>
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <deque>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <chrono>
 #include <mutex>
 #include <iomanip>
+#include <iterator>
+#include <vector>
+#include <set>
 
 #include <fcgio.h>
 #include <fcgiapp.h>
@@ -29,6 +35,13 @@
 
 #include "ClockSetup.h"
 #include "base64.h"
+#include "SlabAllocator.h"
+#include "ObjectIndex.h"
+#include "LruCache.h"
+#include "PathQuery.h"
+#include "PathVersions.h"
+#include "Preconditions.h"
+#include "TimerWheel.h"
 
 
 
@@ -48,11 +61,21 @@ static const std::string CLIENT_ERROR_HEADER =
 
 static const std::string INCORRECT_PATCH_MEDIA_TYPE = 
     "Status: 415 Unsupported Media\r\n"
-    "Accept-Patch: application/json, application/merge-patch+json\r\n";
+    "Accept-Patch: application/json, application/merge-patch+json, application/json-patch+json\r\n";
+
+static const std::string CONFLICT_HEADER = 
+    "Status: 409 Conflict\r\n";
 
 static const std::string PRECONDITION_FAILED_HEADER = 
     "Status: 412 Precondition Failed\r\n";
 
+static const std::string NOT_MODIFIED_HEADER = 
+    "Status: 304 Not Modified\r\n";
+
+static const std::string INCORRECT_POST_MEDIA_TYPE = 
+    "Status: 415 Unsupported Media\r\n"
+    "Accept-Post: application/jsonpath, application/batch+json, application/transaction+json\r\n";
+
 static const std::string METHOD_ERROR_HEADER = 
     "Status: 405 Method Not Allowed\r\n"
     "Allow: GET\r\n";
@@ -65,37 +88,1556 @@ static const std::string METHOD_ERROR_BODY =
 
 static const std::string END_HEADERS = "\r\n";
 
-static const std::string PID_FILE="/var/run/holdmybeer-fcgi.pid";
+// The scripted tests build the daemon with files of their own.
+#ifndef HOLDMYBEER_PID_FILE
+#define HOLDMYBEER_PID_FILE "/var/run/holdmybeer-fcgi.pid"
+#endif
+#ifndef HOLDMYBEER_SETTINGS_FILE
+#define HOLDMYBEER_SETTINGS_FILE "/etc/holdmybeer/settings.json"
+#endif
+
+static const std::string PID_FILE=HOLDMYBEER_PID_FILE;
 static const std::string FCGI_PORT = "/var/run/holdmybeer.sock";
-static const std::string SETTINGS_FILE="/etc/holdmybeer/settings.json";
+static const std::string SETTINGS_FILE=HOLDMYBEER_SETTINGS_FILE;
+
+static const std::string ADMIN_PATH = "/_admin";
+
+static const std::string BATCH_MEDIA_TYPE       = "application/batch+json";
+static const std::string TRANSACTION_MEDIA_TYPE = "application/transaction+json";
+
+static const size_t REQUEST_ARENA_SIZE = 64 * 1024;
+
+// Defaults for automatic compaction, overridable in the settings file.
+static const double DEFAULT_COMPACT_RATIO    = 1.0;
+static const double DEFAULT_COMPACT_MINBYTES = 1024 * 1024;
+
+static const double DEFAULT_POINTER_CACHE    = 1024;
+static const double DEFAULT_QUERY_CACHE      = 256;
+static const double DEFAULT_EXPIRE_BATCH     = 64;
+
+// About a hundred years, more than any TTL needs.
+static const uint64_t MAX_EXPIRE_AFTER = 3200000000ull;
 
 volatile sig_atomic_t powerSwitch = 1;
 
+// The allocator for the document is chosen at build time; see the
+// HOLDMYBEER_SLAB_ALLOCATOR option in CMakeLists.txt.
+#ifdef HOLDMYBEER_SLAB_ALLOCATOR
+typedef SlabAllocator DocAllocator;
+#else
+typedef rapidjson::MemoryPoolAllocator<> DocAllocator;
+#endif
+
+typedef rapidjson::GenericDocument<rapidjson::UTF8<>, DocAllocator> JsonDocument;
+typedef JsonDocument::ValueType JsonValue;
+typedef rapidjson::GenericPointer<JsonValue> JsonPointer;
+
 time_point lastModified;
-rapidjson::Document doc;
+JsonDocument doc;
 rapidjson::Document settings;
 std::mutex docMutex;
 
+// Scratch arena for parsing request bodies. Cleared after every request so
+// rejected and overwritten payloads never land in the document's allocator;
+// only values actually committed are copied into doc.GetAllocator().
+static char requestArenaBuffer[REQUEST_ARENA_SIZE];
+rapidjson::MemoryPoolAllocator<> requestAllocator(requestArenaBuffer, sizeof(requestArenaBuffer));
+
+// MemoryPoolAllocator never frees, so every value we overwrite or remove is
+// left behind in doc's pool. We keep an estimate of those bytes and copy the
+// live tree into a fresh pool when they outweigh the live data. Allocators
+// with kNeedFree reclaim that memory themselves and never accumulate any.
+size_t deadBytes = 0;
+
+// Hash indexes for objects with at least 'indexthreshold' members. All member
+// lookups, additions and removals on doc go through it.
+ObjectIndex<JsonValue> objectIndex;
+
+// Version stamps of the subtrees of doc, bumped by every write. A node's ETag
+// is its version, qualified by an epoch taken at startup since the versions
+// start over with every run; see VersionETag().
+PathVersions pathVersions;
+uint64_t     epoch = 0;
+
+// Expiry deadlines, in seconds since the Unix epoch, of the nodes given a TTL,
+// keyed by canonical pointer. The wheel only says when to look: an entry that
+// comes due with another deadline than this map has was cancelled or reset.
+std::map<std::string, uint64_t> expiries;
+TimerWheel<std::string>         expiryWheel;
+
+// An array declared in "cappedarrays" of the settings, which keeps at most
+// 'maxLength' elements and none older than 'maxAge' seconds, zero meaning no
+// limit. A PUT append that evicts overwrites the oldest element in place, so
+// the array becomes a ring whose first element is at 'head'. Reads follow the
+// ring from its head, see RingPosition(); other writes that may touch the
+// array see it normalized first, see NormalizeCappedArrays().
+struct CappedArray
+{
+    JsonPointer          pointer;
+    std::string          canonical;
+    PathVersions::Path   path;
+    size_t               maxLength = 0;
+    uint64_t             maxAge    = 0;
+    rapidjson::SizeType  head      = 0;
+    std::deque<uint64_t> appended;      // append times, oldest first
+};
+
+// Keyed by canonical pointer.
+std::map<std::string, CappedArray> cappedArrays;
+
+// The capped arrays that are rings and the objects and arrays on the way to
+// them, null for the latter, found again before every request and whenever
+// a ring comes or goes by FindRings(). Keyed by their element or member
+// arrays rather than by the values, which writes elsewhere in their parents
+// may move. Everything else is written with plain Accept().
+std::unordered_map<const void*, const CappedArray*> rings;
+
+// A parsed JSON Pointer with its canonical string, its path for
+// pathVersions and, once looked up, the node it resolves to. Writes forget
+// the resolved nodes they may have moved or replaced; see InvalidateBelow().
+struct CompiledPointer
+{
+    JsonPointer        pointer;
+    std::string        canonical;
+    PathVersions::Path path;
+    JsonValue         *resolved;
+};
+
+// Compiled pointers keyed by the raw PATH_INFO.
+LruCache<std::string, CompiledPointer> pointerCache;
+
+// Compiled JSONPath queries keyed by the query text.
+LruCache<std::string, PathQuery<JsonValue>> queryCache;
+
+// -----------------------------------------------------------------------------
+
+// Approximate number of pool bytes held by a value and everything below it.
+
+size_t Footprint(const JsonValue &value)
+{
+    size_t bytes = 0;
+    if(value.IsObject())
+    {
+        bytes += value.MemberCapacity() * sizeof(JsonValue::Member);
+        for(auto m = value.MemberBegin(); m != value.MemberEnd(); ++m)
+            bytes += Footprint(m->name) + Footprint(m->value);
+    }
+    else if(value.IsArray())
+    {
+        bytes += value.Capacity() * sizeof(JsonValue);
+        for(auto e = value.Begin(); e != value.End(); ++e)
+            bytes += Footprint(*e);
+    }
+    else if(value.IsString())
+        bytes += value.GetStringLength() + 1;
+    return bytes;
+}
+
+// -----------------------------------------------------------------------------
+
+// Must be called for every value of doc that is about to be overwritten or
+// removed, while it is still intact.
+
+void RetireValue(const JsonValue &value)
+{
+    if(!DocAllocator::kNeedFree)
+        deadBytes += Footprint(value);
+    objectIndex.Forget(value);
+}
+
+// -----------------------------------------------------------------------------
+
+// The key of 'value' in 'rings', null for values that can't be in it.
+
+const void *RingKey(const JsonValue &value)
+{
+    if(value.IsArray() && !value.Empty())
+        return value.Begin();
+    if(value.IsObject() && value.MemberCount())
+        return value.MemberBegin().operator->();
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+// The position in 'array' of its element 'index', counting from the head of
+// the array when it is a ring.
+
+rapidjson::SizeType RingPosition(const JsonValue &array, rapidjson::SizeType index)
+{
+    if(rings.empty() || array.Empty())
+        return index;
+    auto ring = rings.find(array.Begin());
+    if(ring == rings.end() || !ring->second || !ring->second->head)
+        return index;
+    return (ring->second->head + index) % array.Size();
+}
+
+// -----------------------------------------------------------------------------
+
+// Writes 'value' to 'writer' like Accept(), but with rings in order from
+// their heads. Only the way down to the rings leaves Accept().
+
+template <class Writer>
+void WriteJson(const JsonValue &value, Writer &writer)
+{
+    const void *key = rings.empty() ? 0 : RingKey(value);
+    if(!key || rings.find(key) == rings.end())
+    {
+        value.Accept(writer);
+        return;
+    }
+
+    if(value.IsObject())
+    {
+        writer.StartObject();
+        for(auto m = value.MemberBegin(); m != value.MemberEnd(); ++m)
+        {
+            writer.Key(m->name.GetString(), m->name.GetStringLength());
+            WriteJson(m->value, writer);
+        }
+        writer.EndObject(value.MemberCount());
+        return;
+    }
+
+    writer.StartArray();
+    rapidjson::SizeType first = RingPosition(value, 0);
+    for(rapidjson::SizeType i = 0; i < value.Size(); ++i)
+        WriteJson(value[(first + i) % value.Size()], writer);
+    writer.EndArray(value.Size());
+}
+
+// -----------------------------------------------------------------------------
+
+// Follows 'count' pointer tokens from 'root', like GenericPointer::Get but
+// using the object indexes. If given, 'depth' receives the number of tokens
+// that could be followed.
+
+JsonValue *FindByTokens(JsonValue &root, const JsonPointer::Token *tokens, size_t count, size_t *depth = 0)
+{
+    JsonValue *v = &root;
+    const JsonPointer::Token *t = tokens;
+    for(; t != tokens + count; ++t)
+    {
+        if(v->IsObject())
+        {
+            auto m = objectIndex.FindMember(*v, t->name, t->length);
+            if(m == v->MemberEnd())
+                break;
+            v = &m->value;
+        }
+        else if(v->IsArray())
+        {
+            if(t->index == rapidjson::kPointerInvalidIndex || t->index >= v->Size())
+                break;
+            v = &(*v)[RingPosition(*v, t->index)];
+        }
+        else
+            break;
+    }
+    if(depth)
+        *depth = t - tokens;
+    return t == tokens + count ? v : 0;
+}
+
+// -----------------------------------------------------------------------------
+
+JsonValue *FindByPointer(JsonValue &root, const JsonPointer &ptr)
+{
+    if(!ptr.IsValid())
+        return 0;
+    return FindByTokens(root, ptr.GetTokens(), ptr.GetTokenCount());
+}
+
+// -----------------------------------------------------------------------------
+
+std::string CanonicalPath(const JsonPointer::Token *tokens, size_t count)
+{
+    rapidjson::StringBuffer buffer;
+    JsonPointer(tokens, count).Stringify(buffer);
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+// -----------------------------------------------------------------------------
+
+// The path of 'tokens' in pathVersions. A "-" appends to an array, which
+// changes the array rather than one of its elements, so the path ends there.
+
+PathVersions::Path VersionPath(const JsonPointer::Token *tokens, size_t count)
+{
+    PathVersions::Path path;
+    path.reserve(count);
+    for(size_t i = 0; i < count && !(tokens[i].length == 1 && tokens[i].name[0] == '-'); ++i)
+        path.emplace_back(tokens[i].name, tokens[i].length);
+    return path;
+}
+
+// -----------------------------------------------------------------------------
+
+// The strong ETag of the node at 'path', "epoch.version", without looking at
+// the node itself: the cost is the depth of the path, not the size of the
+// node. Empty for a node that doesn't exist, as GET sees it.
+
+std::string VersionETag(const JsonValue *node, const PathVersions::Path &path)
+{
+    if(!node || node->IsNull())
+        return std::string();
+    return "\"" + std::to_string(epoch) + "." + std::to_string(pathVersions.Version(path)) + "\"";
+}
+
+// -----------------------------------------------------------------------------
+
+CompiledPointer &CompilePointer(const char *path)
+{
+    std::string key(path ? path : "");
+    CompiledPointer *cached = pointerCache.Find(key);
+    if(cached)
+        return *cached;
+
+    CompiledPointer compiled;
+    compiled.pointer  = JsonPointer(key.c_str(), key.size());
+    compiled.resolved = 0;
+    if(compiled.pointer.IsValid())
+    {
+        compiled.canonical = CanonicalPath(compiled.pointer.GetTokens(), compiled.pointer.GetTokenCount());
+        compiled.path      = VersionPath(compiled.pointer.GetTokens(), compiled.pointer.GetTokenCount());
+    }
+    return pointerCache.Insert(key, compiled);
+}
+
+// -----------------------------------------------------------------------------
+
+JsonValue *Resolve(CompiledPointer &compiled)
+{
+    if(!compiled.resolved)
+        compiled.resolved = FindByPointer(doc, compiled.pointer);
+    return compiled.resolved;
+}
+
+// -----------------------------------------------------------------------------
+
+// Forgets the resolved nodes strictly below 'canonical'. A write must call
+// this for the deepest node it leaves in place: everything below it may have
+// been reallocated, shifted or destroyed.
+
+void InvalidateBelow(const std::string &canonical)
+{
+    std::string prefix = canonical + "/";
+    pointerCache.ForEach([&prefix](const std::string &, CompiledPointer &compiled)
+    {
+        if(compiled.resolved && compiled.canonical.compare(0, prefix.size(), prefix) == 0)
+            compiled.resolved = 0;
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+// The canonical path of 'relative' below the node at 'canonical'.
+
+std::string CanonicalPath(const std::string &canonical, const PathVersions::Path &relative)
+{
+    std::string path = canonical;
+    for(const std::string &token : relative)
+    {
+        path += '/';
+        for(char c : token)
+            path += c == '~' ? "~0" : c == '/' ? "~1" : std::string(1, c);
+    }
+    return path;
+}
+
+// -----------------------------------------------------------------------------
+
+// Bumps the versions of the 'changed' paths, relative to the node of 'base',
+// and forgets the resolved nodes below their parents, since adding or
+// removing a member may move its siblings.
+
+void NoteChanged(const CompiledPointer &base, const std::vector<PathVersions::Path> &changed)
+{
+    std::set<PathVersions::Path> parents;
+    for(const PathVersions::Path &relative : changed)
+    {
+        PathVersions::Path path = base.path;
+        path.insert(path.end(), relative.begin(), relative.end());
+        pathVersions.Touch(path);
+        parents.emplace(relative.begin(), relative.empty() ? relative.end() : relative.end() - 1);
+    }
+
+    for(const PathVersions::Path &parent : parents)
+        InvalidateBelow(CanonicalPath(base.canonical, parent));
+}
+
+// -----------------------------------------------------------------------------
+
+// Same semantics as GenericPointer::Create: missing members are added as
+// null, arrays are padded with nulls up to the index, "-" appends to an array
+// and scalars in the way are turned into containers.
+
+JsonValue &CreateByPointer(JsonValue &root, const JsonPointer &ptr, DocAllocator &allocator)
+{
+    JsonValue *v = &root;
+    const JsonPointer::Token *tokens = ptr.GetTokens();
+    for(const JsonPointer::Token *t = tokens; t != tokens + ptr.GetTokenCount(); ++t)
+    {
+        if(v->IsArray() && t->length == 1 && t->name[0] == '-')
+        {
+            v->PushBack(JsonValue().Move(), allocator);
+            v = &((*v)[v->Size() - 1]);
+            continue;
+        }
+
+        if(t->index == rapidjson::kPointerInvalidIndex)
+        {
+            if(!v->IsObject())
+            {
+                RetireValue(*v);
+                v->SetObject();
+            }
+        }
+        else if(!v->IsArray() && !v->IsObject())
+        {
+            RetireValue(*v);
+            v->SetArray();
+        }
+
+        if(v->IsArray())
+        {
+            if(t->index >= v->Size())
+            {
+                v->Reserve(t->index + 1, allocator);
+                while(t->index >= v->Size())
+                    v->PushBack(JsonValue().Move(), allocator);
+            }
+            v = &((*v)[t->index]);
+        }
+        else
+        {
+            auto m = objectIndex.FindMember(*v, t->name, t->length);
+            if(m == v->MemberEnd())
+            {
+                JsonValue name(t->name, t->length, allocator);
+                JsonValue value;
+                objectIndex.AddMember(*v, name, value, allocator);
+                m = v->MemberEnd() - 1;
+            }
+            v = &m->value;
+        }
+    }
+    return *v;
+}
+
+// -----------------------------------------------------------------------------
+
+// Removes the value at 'ptr', retiring it first, keeping the order of the
+// members or elements after it as EraseValueByPointer does. Returns false if
+// there is nothing to remove.
+
+bool EraseByPointer(JsonValue &root, const JsonPointer &ptr)
+{
+    if(!ptr.IsValid() || ptr.GetTokenCount() == 0)
+        return false;
+
+    const JsonPointer::Token &last = ptr.GetTokens()[ptr.GetTokenCount() - 1];
+    JsonValue *parent = FindByTokens(root, ptr.GetTokens(), ptr.GetTokenCount() - 1);
+    if(!parent)
+        return false;
+
+    if(parent->IsObject())
+    {
+        auto m = objectIndex.FindMember(*parent, last.name, last.length);
+        if(m == parent->MemberEnd())
+            return false;
+        RetireValue(m->name);
+        RetireValue(m->value);
+        objectIndex.EraseMember(*parent, m);
+        return true;
+    }
+
+    if(parent->IsArray())
+    {
+        if(last.index == rapidjson::kPointerInvalidIndex || last.index >= parent->Size())
+            return false;
+        RetireValue((*parent)[last.index]);
+        parent->Erase(parent->Begin() + last.index);
+        return true;
+    }
+
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+
+uint64_t UnixSeconds()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(local_clock::now().time_since_epoch()).count();
+}
+
+// -----------------------------------------------------------------------------
+
+// Whether the node at 'ptr', existing or about to be created, can be given a
+// TTL: it must be a member of an object whose ancestors are all objects too,
+// so that no array shift can move another node to its path.
+
+bool Expirable(const JsonPointer &ptr)
+{
+    if(!ptr.IsValid() || ptr.GetTokenCount() == 0)
+        return false;
+
+    JsonValue *v = &doc;
+    const JsonPointer::Token *tokens = ptr.GetTokens();
+    for(const JsonPointer::Token *t = tokens; t != tokens + ptr.GetTokenCount(); ++t)
+    {
+        if(v && v->IsArray())
+            return false;
+        if(!v || !v->IsObject())
+        {
+            // Created by the write; an index would make an array of it.
+            if(t->index != rapidjson::kPointerInvalidIndex)
+                return false;
+            v = 0;
+            continue;
+        }
+        auto m = objectIndex.FindMember(*v, t->name, t->length);
+        v = m == v->MemberEnd() ? 0 : &m->value;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void SetExpiry(const std::string &canonical, uint64_t deadline)
+{
+    expiries[canonical] = deadline;
+    expiryWheel.Schedule(canonical, deadline);
+}
+
+// -----------------------------------------------------------------------------
+
+// Drops the TTLs of the node at 'canonical' and of everything below it. Their
+// timers stay in the wheel and are ignored when they come due.
+
+void ClearExpiries(const std::string &canonical)
+{
+    std::string prefix = canonical + "/";
+    expiries.erase(canonical);
+    auto e = expiries.lower_bound(prefix);
+    while(e != expiries.end() && e->first.compare(0, prefix.size(), prefix) == 0)
+        e = expiries.erase(e);
+}
+
+// -----------------------------------------------------------------------------
+
+// The capped array a PUT to 'compiled' appends to, or null if it appends to
+// none.
+
+CappedArray *CappedAppendTarget(const CompiledPointer &compiled)
+{
+    const JsonPointer &ptr = compiled.pointer;
+    size_t count = ptr.GetTokenCount();
+    if(cappedArrays.empty() || !ptr.IsValid() || count == 0)
+        return 0;
+
+    const JsonPointer::Token &last = ptr.GetTokens()[count - 1];
+    if(last.length != 1 || last.name[0] != '-')
+        return 0;
+
+    auto capped = cappedArrays.find(CanonicalPath(ptr.GetTokens(), count - 1));
+    return capped == cappedArrays.end() ? 0 : &capped->second;
+}
+
+// -----------------------------------------------------------------------------
+
+// The capped array at 'array', or null if it isn't one.
+
+CappedArray *CappedArrayAt(const JsonValue &array)
+{
+    for(auto &entry : cappedArrays)
+    {
+        if(FindByPointer(doc, entry.second.pointer) == &array)
+            return &entry.second;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+// How many of the oldest elements of a capped array of 'size' elements an
+// append at 'now' evicts: those over its length with the new one, then those
+// too old. Ages only count while the append times are in sync.
+
+size_t Evictions(const CappedArray &capped, size_t size, uint64_t now)
+{
+    size_t count = capped.maxLength && size >= capped.maxLength ? size - capped.maxLength + 1 : 0;
+    if(capped.maxAge && capped.appended.size() == size)
+    {
+        while(count < size && capped.appended[count] + capped.maxAge <= now)
+            ++count;
+    }
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+
+// Finds the capped arrays that are rings and the way down to them. Called
+// before every request, as the last one may have moved their elements, and
+// whenever a ring comes or goes. Caller holds docMutex.
+
+void FindRings()
+{
+    rings.clear();
+    for(const auto &entry : cappedArrays)
+    {
+        const CappedArray &capped = entry.second;
+        const JsonValue *array = capped.head ? FindByPointer(doc, capped.pointer) : 0;
+        if(!array || !array->IsArray() || array->Empty())
+            continue;
+
+        const JsonPointer::Token *tokens = capped.pointer.GetTokens();
+        for(size_t count = 0; count < capped.pointer.GetTokenCount(); ++count)
+            rings.emplace(RingKey(*FindByTokens(doc, tokens, count)), (const CappedArray *)0);
+        rings[array->Begin()] = &capped;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// Removes the 'count' oldest elements of a normalized capped array.
+
+void EraseOldest(CappedArray &capped, JsonValue &array, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        RetireValue(array[(rapidjson::SizeType)i]);
+    array.Erase(array.Begin(), array.Begin() + count);
+    capped.appended.erase(capped.appended.begin(), capped.appended.begin() + count);
+    pathVersions.Touch(capped.path);
+    InvalidateBelow(capped.canonical);
+}
+
+// -----------------------------------------------------------------------------
+
+// Rotates a capped array back to its first element, resyncs the append times
+// after other writes and drops what is over its limits. Writes other than
+// appends may have added or removed elements, and then the ages of all of
+// them count from 'now'.
+
+void NormalizeCappedArray(CappedArray &capped, uint64_t now)
+{
+    JsonValue *array = FindByPointer(doc, capped.pointer);
+    if(!array || !array->IsArray())
+    {
+        bool ring = capped.head;
+        capped.head = 0;
+        capped.appended.clear();
+        if(ring)
+            FindRings();
+        return;
+    }
+
+    if(capped.head)
+    {
+        std::rotate(array->Begin(), array->Begin() + capped.head, array->End());
+        capped.head = 0;
+        FindRings();
+        InvalidateBelow(capped.canonical);
+    }
+
+    if(capped.appended.size() != array->Size())
+        capped.appended.assign(array->Size(), now);
+
+    size_t drop = capped.maxLength && array->Size() > capped.maxLength ? array->Size() - capped.maxLength : 0;
+    while(capped.maxAge && drop < capped.appended.size() && capped.appended[drop] + capped.maxAge <= now)
+        ++drop;
+    if(drop)
+        EraseOldest(capped, *array, drop);
+}
+
+// -----------------------------------------------------------------------------
+
+// Normalizes the capped arrays a write to 'canonical' may reach or change
+// the shape of: those at, above or below it. Reads leave rings alone.
+// Caller holds docMutex.
+
+void NormalizeCappedArrays(const std::string &canonical)
+{
+    uint64_t now = UnixSeconds();
+    for(auto &entry : cappedArrays)
+    {
+        const std::string &at = entry.first;
+        const std::string &shorter = at.size() < canonical.size() ? at : canonical;
+        const std::string &longer  = at.size() < canonical.size() ? canonical : at;
+        if(longer.compare(0, shorter.size(), shorter) == 0 
+           && (longer.size() == shorter.size() || longer[shorter.size()] == '/'))
+            NormalizeCappedArray(entry.second, now);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// Appends 'value' to the capped array 'compiled' appends to, in constant time
+// when that evicts the oldest element, which is then overwritten in place.
+// Returns the new element, or null if 'compiled' is no append to an existing
+// capped array.
+
+JsonValue *AppendToCappedArray(const CompiledPointer &compiled, JsonValue &value)
+{
+    CappedArray *capped = CappedAppendTarget(compiled);
+    JsonValue *array = capped ? FindByPointer(doc, capped->pointer) : 0;
+    if(!array || !array->IsArray())
+        return 0;
+
+    // Only a single eviction is done in place.
+    uint64_t now = UnixSeconds();
+    if(capped->appended.size() != array->Size() || Evictions(*capped, array->Size(), now) > 1)
+        NormalizeCappedArray(*capped, now);
+
+    rapidjson::SizeType size = array->Size();
+    bool evict = Evictions(*capped, size, now) > 0;
+    capped->appended.push_back(now);
+    if(evict)
+    {
+        capped->appended.pop_front();
+        JsonValue &oldest = (*array)[capped->head];
+        RetireValue(oldest);
+        oldest = value;
+        capped->head = (capped->head + 1) % size;
+        if(capped->head <= 1)
+            FindRings();
+        return &oldest;
+    }
+
+    // Growing a ring needs its first element at the front again.
+    if(capped->head)
+    {
+        std::rotate(array->Begin(), array->Begin() + capped->head, array->End());
+        capped->head = 0;
+        FindRings();
+    }
+    array->PushBack(value, doc.GetAllocator());
+    return &(*array)[size];
+}
+
+// -----------------------------------------------------------------------------
+
+// Applies an RFC 7396 merge patch in one pass, with one member lookup per
+// key of the patch. The patch may live in another allocator, such as the
+// request arena; only what it sets is copied into 'allocator'. The paths of
+// the nodes it replaced, added or removed, relative to 'target', are added
+// to 'changed' unless that is null. 'at' is the path of 'target' on the way
+// down.
+
+template<class PatchValue>
+void JsonMergePatch(JsonValue &target, const PatchValue &patch, DocAllocator &allocator, 
+                    PathVersions::Path &at, std::vector<PathVersions::Path> *changed)
+{ 
+    if(!patch.IsObject()) 
+    {
+        RetireValue(target);
+        target.CopyFrom(patch, allocator);
+        if(changed)
+            changed->push_back(at);
+        return;
+    }
+
+    if(!target.IsObject()) 
+    {
+        RetireValue(target);
+        target.SetObject();
+
+        // Everything below is new, the change is this node.
+        if(changed)
+            changed->push_back(at);
+        changed = 0;
+    }
+
+    for(auto p = patch.MemberBegin(); p != patch.MemberEnd(); ++p) 
+    {
+        auto m = objectIndex.FindMember(target, p->name.GetString(), p->name.GetStringLength());
+        if(changed)
+            at.emplace_back(p->name.GetString(), p->name.GetStringLength());
+
+        if(p->value.IsNull())
+        {
+            if(m != target.MemberEnd())
+            {
+                RetireValue(m->name);
+                RetireValue(m->value);
+                objectIndex.EraseMember(target, m);
+                if(changed)
+                    changed->push_back(at);
+            }
+        }
+        else if(m != target.MemberEnd())
+            JsonMergePatch(m->value, p->value, allocator, at, changed);
+        else
+        {
+            JsonValue name(p->name, allocator);
+            JsonValue value;
+            JsonMergePatch(value, p->value, allocator, at, 0);
+            objectIndex.AddMember(target, name, value, allocator);
+            if(changed)
+                changed->push_back(at);
+        }
+
+        if(changed)
+            at.pop_back();
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// One change made by a JSON Patch, with what it takes to undo it. Pointers
+// are relative to the patched node.
+
+struct PatchUndo
+{
+    enum Kind
+    {
+        ADDED_MEMBER,       // the last member of the object at 'pointer's parent
+        REMOVED_MEMBER,     // 'name' and 'value' were at 'position' of the parent
+        REPLACED,           // 'value' was at 'pointer'
+        INSERTED,           // the element at 'position' of the parent
+        ERASED              // 'value' was the element at 'position' of the parent
+    };
+
+    PatchUndo(Kind kind, const JsonPointer &pointer) : kind(kind), pointer(pointer), position(0), capped(0), appendedAt(0) {}
+
+    Kind                kind;
+    JsonPointer         pointer;
+    rapidjson::SizeType position;
+    JsonValue           name;
+    JsonValue           value;
+    CappedArray        *capped;         // whose append times the change moved
+    uint64_t            appendedAt;     // ERASED: the append time it took
+};
+
+// -----------------------------------------------------------------------------
+
+// Arrays have no insert; push and rotate into place.
+
+void InsertElement(JsonValue &array, rapidjson::SizeType index, JsonValue &value, DocAllocator &allocator)
+{
+    array.PushBack(value, allocator);
+    for(rapidjson::SizeType i = array.Size() - 1; i > index; --i)
+        array[i].Swap(array[i - 1]);
+}
+
+// -----------------------------------------------------------------------------
+
+// Objects have none either; add and move into place the same way.
+
+void InsertMember(JsonValue &object, rapidjson::SizeType position, JsonValue &name, JsonValue &value, DocAllocator &allocator)
+{
+    objectIndex.AddMember(object, name, value, allocator);
+    rapidjson::SizeType last = object.MemberCount() - 1;
+    for(rapidjson::SizeType i = last; i > position; --i)
+    {
+        auto m = object.MemberBegin() + i;
+        m->name.Swap((m - 1)->name);
+        m->value.Swap((m - 1)->value);
+    }
+    if(position != last)
+        objectIndex.Reordered(object);
+}
+
+// -----------------------------------------------------------------------------
+
+// The parts of a patch operation, each moving its value into the document
+// and logging the change. They return false, changing nothing, when the
+// target isn't there.
+
+bool PatchReplace(JsonValue &root, const JsonPointer &ptr, JsonValue &value, std::vector<PatchUndo> &undo)
+{
+    JsonValue *target = FindByPointer(root, ptr);
+    if(!target)
+        return false;
+
+    undo.emplace_back(PatchUndo::REPLACED, ptr);
+    undo.back().value.Swap(*target);
+    target->Swap(value);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Makes room for an append to the capped array 'array' as AppendToCappedArray()
+// does, but logged: the oldest elements go as removals of element 0.
+
+void PatchEvict(CappedArray &capped, JsonValue &array, const JsonPointer &ptr, std::vector<PatchUndo> &undo)
+{
+    size_t count = Evictions(capped, array.Size(), UnixSeconds());
+    bool synced = capped.appended.size() == array.Size();
+    for(size_t i = 0; i < count; ++i)
+    {
+        undo.emplace_back(PatchUndo::ERASED, ptr);
+        PatchUndo &entry = undo.back();
+        entry.value.Swap(array[0]);
+        array.Erase(array.Begin());
+        if(synced)
+        {
+            entry.capped     = &capped;
+            entry.appendedAt = capped.appended.front();
+            capped.appended.pop_front();
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool PatchAdd(JsonValue &root, const JsonPointer &ptr, JsonValue &value, std::vector<PatchUndo> &undo, DocAllocator &allocator)
+{
+    size_t count = ptr.GetTokenCount();
+    if(count == 0)
+        return PatchReplace(root, ptr, value, undo);
+
+    const JsonPointer::Token &last = ptr.GetTokens()[count - 1];
+    JsonValue *parent = FindByTokens(root, ptr.GetTokens(), count - 1);
+    if(!parent)
+        return false;
+
+    if(parent->IsObject())
+    {
+        if(objectIndex.FindMember(*parent, last.name, last.length) != parent->MemberEnd())
+            return PatchReplace(root, ptr, value, undo);
+
+        JsonValue name(last.name, last.length, allocator);
+        objectIndex.AddMember(*parent, name, value, allocator);
+        undo.emplace_back(PatchUndo::ADDED_MEMBER, ptr);
+        return true;
+    }
+
+    if(parent->IsArray())
+    {
+        // Appends to a capped array keep to its limits.
+        bool append = last.length == 1 && last.name[0] == '-';
+        CappedArray *capped = append ? CappedArrayAt(*parent) : 0;
+        bool synced = capped && capped->appended.size() == parent->Size();
+        if(capped)
+            PatchEvict(*capped, *parent, ptr, undo);
+
+        rapidjson::SizeType index = append ? parent->Size() : last.index;
+        if(index == rapidjson::kPointerInvalidIndex || index > parent->Size())
+            return false;
+
+        InsertElement(*parent, index, value, allocator);
+        undo.emplace_back(PatchUndo::INSERTED, ptr);
+        undo.back().position = index;
+        if(synced)
+        {
+            capped->appended.push_back(UnixSeconds());
+            undo.back().capped = capped;
+        }
+        return true;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+
+bool PatchRemove(JsonValue &root, const JsonPointer &ptr, std::vector<PatchUndo> &undo, DocAllocator &allocator)
+{
+    size_t count = ptr.GetTokenCount();
+    if(count == 0)
+        return false;
+
+    const JsonPointer::Token &last = ptr.GetTokens()[count - 1];
+    JsonValue *parent = FindByTokens(root, ptr.GetTokens(), count - 1);
+    if(!parent)
+        return false;
+
+    if(parent->IsObject())
+    {
+        auto m = objectIndex.FindMember(*parent, last.name, last.length);
+        if(m == parent->MemberEnd())
+            return false;
+
+        // The index needs the name while removing, so the log keeps a copy.
+        undo.emplace_back(PatchUndo::REMOVED_MEMBER, ptr);
+        PatchUndo &entry = undo.back();
+        entry.position = static_cast<rapidjson::SizeType>(m - parent->MemberBegin());
+        entry.name.CopyFrom(m->name, allocator);
+        entry.value.Swap(m->value);
+        RetireValue(m->name);
+        objectIndex.EraseMember(*parent, m);
+        return true;
+    }
+
+    if(parent->IsArray())
+    {
+        if(last.index == rapidjson::kPointerInvalidIndex || last.index >= parent->Size())
+            return false;
+
+        undo.emplace_back(PatchUndo::ERASED, ptr);
+        undo.back().position = last.index;
+        undo.back().value.Swap((*parent)[last.index]);
+        parent->Erase(parent->Begin() + last.index);
+        return true;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+
+// Applies the merge patch 'patch' to the node at 'ptr' as JsonMergePatch()
+// does, but logged member by member, so that only what the patch replaces,
+// adds or removes is kept for the undo rather than a copy of the node. The
+// paths of those, below 'at', are added to 'changed'.
+
+template<class PatchValue>
+bool PatchMerge(JsonValue &root, const JsonPointer &ptr, const PatchValue &patch, std::vector<PatchUndo> &undo,
+                DocAllocator &allocator, PathVersions::Path &at, std::vector<PathVersions::Path> &changed)
+{
+    JsonValue *target = FindByPointer(root, ptr);
+    if(!target)
+        return false;
+
+    // Only an object merges into an object; anything else replaces the node.
+    if(!patch.IsObject() || !target->IsObject())
+    {
+        JsonValue value;
+        JsonMergePatch(value, patch, allocator, at, 0);
+        changed.push_back(at);
+        return PatchReplace(root, ptr, value, undo);
+    }
+
+    for(auto p = patch.MemberBegin(); p != patch.MemberEnd(); ++p)
+    {
+        JsonPointer member = ptr.Append(p->name.GetString(), p->name.GetStringLength());
+        bool present = objectIndex.FindMember(*target, p->name.GetString(), p->name.GetStringLength()) != target->MemberEnd();
+        at.emplace_back(p->name.GetString(), p->name.GetStringLength());
+        if(p->value.IsNull())
+        {
+            if(present)
+            {
+                PatchRemove(root, member, undo, allocator);
+                changed.push_back(at);
+            }
+        }
+        else if(present)
+            PatchMerge(root, member, p->value, undo, allocator, at, changed);
+        else
+        {
+            JsonValue value;
+            JsonMergePatch(value, p->value, allocator, at, 0);
+            PatchAdd(root, member, value, undo, allocator);
+            changed.push_back(at);
+        }
+        at.pop_back();
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Takes back the changes in 'undo', last first, leaving 'root' as it was
+// before the patch.
+
+void RollbackPatch(JsonValue &root, std::vector<PatchUndo> &undo, DocAllocator &allocator)
+{
+    for(auto entry = undo.rbegin(); entry != undo.rend(); ++entry)
+    {
+        const JsonPointer &ptr = entry->pointer;
+        size_t count = ptr.GetTokenCount();
+        JsonValue *parent = count ? FindByTokens(root, ptr.GetTokens(), count - 1) : 0;
+        switch(entry->kind)
+        {
+            case PatchUndo::ADDED_MEMBER:
+            {
+                auto m = parent->MemberEnd() - 1;
+                RetireValue(m->name);
+                RetireValue(m->value);
+                objectIndex.RemoveMember(*parent, m);
+                break;
+            }
+            case PatchUndo::REMOVED_MEMBER:
+                InsertMember(*parent, entry->position, entry->name, entry->value, allocator);
+                break;
+            case PatchUndo::REPLACED:
+            {
+                JsonValue *target = FindByPointer(root, ptr);
+                RetireValue(*target);
+                target->Swap(entry->value);
+                break;
+            }
+            case PatchUndo::INSERTED:
+                RetireValue((*parent)[entry->position]);
+                parent->Erase(parent->Begin() + entry->position);
+                if(entry->capped)
+                    entry->capped->appended.pop_back();
+                break;
+            case PatchUndo::ERASED:
+                InsertElement(*parent, entry->position, entry->value, allocator);
+                if(entry->capped)
+                    entry->capped->appended.push_front(entry->appendedAt);
+                break;
+        }
+    }
+    undo.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+// Keeps the changes in 'undo', made below the node at 'base': each bumps the
+// version of the path it changed, and whatever they replaced or removed is
+// garbage.
+
+void CommitPatch(std::vector<PatchUndo> &undo, const PathVersions::Path &base)
+{
+    for(PatchUndo &entry : undo)
+    {
+        // Inserting or erasing an element shifts the ones after it, which
+        // changes the whole array.
+        size_t count = entry.pointer.GetTokenCount();
+        if(entry.kind == PatchUndo::INSERTED || entry.kind == PatchUndo::ERASED)
+            --count;
+        PathVersions::Path path = base;
+        PathVersions::Path below = VersionPath(entry.pointer.GetTokens(), count);
+        path.insert(path.end(), below.begin(), below.end());
+        pathVersions.Touch(path);
+
+        if(entry.kind == PatchUndo::REMOVED_MEMBER)
+            RetireValue(entry.name);
+        RetireValue(entry.value);
+    }
+    undo.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+// Checks that 'patch' is an RFC 6902 JSON Patch document: an array of
+// operations with the members their "op" needs and valid pointers.
+
+bool ValidJsonPatch(const rapidjson::Value &patch)
+{
+    if(!patch.IsArray())
+        return false;
+
+    for(auto &op : patch.GetArray())
+    {
+        if(!op.IsObject() || !op.HasMember("op") || !op["op"].IsString() || !op.HasMember("path") || !op["path"].IsString())
+            return false;
+        if(!JsonPointer(op["path"].GetString(), op["path"].GetStringLength()).IsValid())
+            return false;
+
+        std::string name(op["op"].GetString(), op["op"].GetStringLength());
+        if(name == "add" || name == "replace" || name == "test")
+        {
+            if(!op.HasMember("value"))
+                return false;
+        }
+        else if(name == "move" || name == "copy")
+        {
+            if(!op.HasMember("from") || !op["from"].IsString() 
+               || !JsonPointer(op["from"].GetString(), op["from"].GetStringLength()).IsValid())
+                return false;
+        }
+        else if(name != "remove")
+            return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Applies a validated RFC 6902 JSON Patch to 'target', found at 'base', all
+// or nothing: each change is logged, and when an operation fails the log is
+// played backwards. Returns the position of the failed operation, or -1.
+// Values are copied from the patch into 'allocator'. On success the canonical
+// pointers, relative to 'target', of the nodes it replaced or removed are
+// added to 'replaced'.
+
+int JsonPatch(JsonValue &target, const PathVersions::Path &base, const rapidjson::Value &patch, 
+              std::vector<std::string> &replaced, DocAllocator &allocator)
+{
+    std::vector<std::string> paths;
+    std::vector<PatchUndo> undo;
+    undo.reserve(patch.Size() * 2);
+
+    int position = 0;
+    for(auto &op : patch.GetArray())
+    {
+        std::string name(op["op"].GetString(), op["op"].GetStringLength());
+        JsonPointer ptr(op["path"].GetString(), op["path"].GetStringLength());
+
+        bool done = false;
+        if(name == "add" || name == "replace")
+        {
+            JsonValue value(op["value"], allocator);
+            done = name == "add" ? PatchAdd(target, ptr, value, undo, allocator) 
+                                 : PatchReplace(target, ptr, value, undo);
+            if(!done)
+                RetireValue(value);
+        }
+        else if(name == "remove")
+            done = PatchRemove(target, ptr, undo, allocator);
+        else if(name == "test")
+        {
+            JsonValue *value = FindByPointer(target, ptr);
+            done = value && *value == op["value"];
+        }
+        else
+        {
+            JsonPointer from(op["from"].GetString(), op["from"].GetStringLength());
+            JsonValue *source = FindByPointer(target, from);
+
+            // A value can't be moved into itself.
+            bool inside = name == "move" && ptr.GetTokenCount() > from.GetTokenCount() 
+                       && JsonPointer(ptr.GetTokens(), from.GetTokenCount()) == from;
+            if(source && !inside)
+            {
+                JsonValue value(*source, allocator);
+                done = (name == "copy" || PatchRemove(target, from, undo, allocator))
+                    && PatchAdd(target, ptr, value, undo, allocator);
+                if(!done)
+                    RetireValue(value);
+            }
+        }
+
+        if(!done)
+        {
+            RollbackPatch(target, undo, allocator);
+            return position;
+        }
+        if(name != "test")
+            paths.push_back(CanonicalPath(ptr.GetTokens(), ptr.GetTokenCount()));
+        if(name == "move")
+        {
+            JsonPointer from(op["from"].GetString(), op["from"].GetStringLength());
+            paths.push_back(CanonicalPath(from.GetTokens(), from.GetTokenCount()));
+        }
+        ++position;
+    }
+
+    CommitPatch(undo, base);
+    replaced.insert(replaced.end(), paths.begin(), paths.end());
+    return -1;
+}
+
+// -----------------------------------------------------------------------------
+
+// Checks that 'transaction' is an object with an optional array of
+// "preconditions", each a "pointer" with the "etag" the node must have or
+// whether it "exists", and an array of "operations", each with an "op" on a
+// "pointer": "put", "merge", "delete", the atomic "incr", "min", "max" and
+// "append", or "cas" with the "expected" value. All but "delete" take a
+// "value", a number for "incr", "min" and "max".
+
+bool ValidTransaction(const rapidjson::Value &transaction)
+{
+    if(!transaction.IsObject() || !transaction.HasMember("operations") || !transaction["operations"].IsArray())
+        return false;
+
+    auto validPointer = [](const rapidjson::Value &item) -> bool
+    {
+        return item.IsObject() && item.HasMember("pointer") && item["pointer"].IsString()
+            && JsonPointer(item["pointer"].GetString(), item["pointer"].GetStringLength()).IsValid();
+    };
+
+    if(transaction.HasMember("preconditions"))
+    {
+        if(!transaction["preconditions"].IsArray())
+            return false;
+        for(auto &condition : transaction["preconditions"].GetArray())
+        {
+            if(!validPointer(condition))
+                return false;
+            bool etag   = condition.HasMember("etag") && condition["etag"].IsString();
+            bool exists = condition.HasMember("exists") && condition["exists"].IsBool();
+            if(etag == exists)
+                return false;
+        }
+    }
+
+    for(auto &op : transaction["operations"].GetArray())
+    {
+        if(!validPointer(op) || !op.HasMember("op") || !op["op"].IsString())
+            return false;
+        std::string name(op["op"].GetString(), op["op"].GetStringLength());
+        bool hasValue = op.HasMember("value");
+        if(name == "put" || name == "merge" || name == "append")
+        {
+            if(!hasValue)
+                return false;
+        }
+        else if(name == "incr" || name == "min" || name == "max")
+        {
+            if(!hasValue || !op["value"].IsNumber())
+                return false;
+        }
+        else if(name == "cas")
+        {
+            if(!hasValue || !op.HasMember("expected"))
+                return false;
+        }
+        else if(name != "delete")
+            return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Returns the position of the first of the validated 'preconditions' that
+// doesn't hold at 'target', found at 'base', or -1.
+
+int FailedPrecondition(JsonValue &target, const PathVersions::Path &base, const rapidjson::Value &preconditions)
+{
+    int position = 0;
+    for(auto &condition : preconditions.GetArray())
+    {
+        JsonPointer ptr(condition["pointer"].GetString(), condition["pointer"].GetStringLength());
+        JsonValue *node = FindByPointer(target, ptr);
+        bool holds;
+        if(condition.HasMember("exists"))
+            holds = (node != 0) == condition["exists"].GetBool();
+        else
+        {
+            PathVersions::Path path = base;
+            PathVersions::Path below = VersionPath(ptr.GetTokens(), ptr.GetTokenCount());
+            path.insert(path.end(), below.begin(), below.end());
+            holds = VersionETag(node, path) == condition["etag"].GetString();
+        }
+        if(!holds)
+            return position;
+        ++position;
+    }
+    return -1;
+}
+
+// -----------------------------------------------------------------------------
+
+// Sets 'result' to the number 'number', keeping it an integer if it is one.
+
+template<class Value>
+void SetNumber(const Value &number, JsonValue &result)
+{
+    if(number.IsInt64())
+        result.SetInt64(number.GetInt64());
+    else if(number.IsUint64())
+        result.SetUint64(number.GetUint64());
+    else
+        result.SetDouble(number.GetDouble());
+}
+
+// -----------------------------------------------------------------------------
+
+// The number 'operation' ("incr", "min" or "max") makes of 'current' and
+// 'operand'. Integers stay integers unless the sum overflows.
+
+void Arithmetic(const std::string &operation, const JsonValue &current, const rapidjson::Value &operand, JsonValue &result)
+{
+    bool integral = current.IsInt64() && operand.IsInt64();
+    if(operation == "incr")
+    {
+        int64_t sum;
+        if(integral && !__builtin_add_overflow(current.GetInt64(), operand.GetInt64(), &sum))
+            result.SetInt64(sum);
+        else
+            result.SetDouble(current.GetDouble() + operand.GetDouble());
+        return;
+    }
+
+    bool less = integral ? operand.GetInt64() < current.GetInt64() : operand.GetDouble() < current.GetDouble();
+    bool more = integral ? operand.GetInt64() > current.GetInt64() : operand.GetDouble() > current.GetDouble();
+    if(operation == "min" ? less : more)
+        SetNumber(operand, result);
+    else
+        SetNumber(current, result);
+}
+
+// -----------------------------------------------------------------------------
+
+// Applies the validated operations of a transaction to 'target', found at
+// 'base', all or nothing, logging them as JsonPatch() does, and adds to 'written' the
+// pointer each operation wrote to. A put replaces the node or adds it to an
+// existing parent, a merge applies a merge patch to an existing node and a
+// delete removes one. The atomic operations read and write the node in the
+// same step: incr adds to a number, min and max keep the smaller or larger,
+// append adds to the end of an array and cas replaces a node equal to the
+// expected value. incr, min and max on a missing node set it to the value.
+// Returns the position of the failed operation, or -1. On success the
+// canonical pointers, relative to 'target', of the nodes that a put, cas,
+// merge or delete replaced or removed are added to 'replaced'.
+
+int Transact(JsonValue &target, const PathVersions::Path &base, const rapidjson::Value &operations, 
+             std::vector<std::string> &written, std::vector<std::string> &replaced, DocAllocator &allocator)
+{
+    std::vector<std::string> paths;
+    std::vector<PatchUndo> undo;
+    undo.reserve(operations.Size());
+
+    int position = 0;
+    for(auto &op : operations.GetArray())
+    {
+        std::string name(op["op"].GetString(), op["op"].GetStringLength());
+        std::string pointer(op["pointer"].GetString(), op["pointer"].GetStringLength());
+        if(name == "append")
+            pointer += "/-";
+        JsonPointer ptr(pointer.c_str(), pointer.size());
+        JsonValue *node = FindByPointer(target, ptr);
+        size_t logged = undo.size();
+        std::string canonical = CanonicalPath(ptr.GetTokens(), ptr.GetTokenCount());
+
+        bool done = false;
+        if(name == "put" || name == "append" || (!node && (name == "incr" || name == "min" || name == "max")))
+        {
+            JsonValue value(op["value"], allocator);
+            done = node ? PatchReplace(target, ptr, value, undo) 
+                        : PatchAdd(target, ptr, value, undo, allocator);
+            if(!done)
+                RetireValue(value);
+            else if(name == "put")
+                paths.push_back(canonical);
+        }
+        else if(name == "incr" || name == "min" || name == "max")
+        {
+            if(node->IsNumber())
+            {
+                JsonValue value;
+                Arithmetic(name, *node, op["value"], value);
+                done = (name != "incr" && value == *node) || PatchReplace(target, ptr, value, undo);
+            }
+        }
+        else if(name == "cas")
+        {
+            if(node && *node == op["expected"])
+            {
+                JsonValue value(op["value"], allocator);
+                done = PatchReplace(target, ptr, value, undo);
+                paths.push_back(canonical);
+            }
+        }
+        else if(name == "merge")
+        {
+            // Only what the merge replaced or removed counts as replaced.
+            PathVersions::Path at;
+            std::vector<PathVersions::Path> changed;
+            done = PatchMerge(target, ptr, op["value"], undo, allocator, at, changed);
+            for(const PathVersions::Path &relative : changed)
+                paths.push_back(CanonicalPath(canonical, relative));
+        }
+        else
+        {
+            done = PatchRemove(target, ptr, undo, allocator);
+            paths.push_back(canonical);
+        }
+
+        if(!done)
+        {
+            RollbackPatch(target, undo, allocator);
+            return position;
+        }
+
+        // An insert into an array wrote to the index it landed at.
+        if(undo.size() > logged && undo.back().kind == PatchUndo::INSERTED)
+            pointer = pointer.substr(0, pointer.rfind('/') + 1) + std::to_string(undo.back().position);
+        written.push_back(pointer);
+        ++position;
+    }
+
+    CommitPatch(undo, base);
+    replaced.insert(replaced.end(), paths.begin(), paths.end());
+    return -1;
+}
+
+// -----------------------------------------------------------------------------
+
+// Copies the live tree into a fresh pool and releases the old chunks.
+// Caller holds docMutex.
+
+void CompactDocument()
+{
+    JsonDocument fresh;
+    fresh.CopyFrom(doc, fresh.GetAllocator(), true);
+    doc.Swap(fresh);
+    deadBytes = 0;
+    objectIndex.Clear();
+    InvalidateBelow("");
+    FindRings();
+}
+
+// -----------------------------------------------------------------------------
+
+double SettingAsDouble(const char *name, double fallback)
+{
+    auto m = settings.FindMember(name);
+    return (m != settings.MemberEnd() && m->value.IsNumber()) ? m->value.GetDouble() : fallback;
+}
+
+// -----------------------------------------------------------------------------
+
+// Compacts when the estimated dead bytes exceed 'compactratio' times the live
+// bytes and 'compactminbytes' in total. Run between requests, after the
+// response has been flushed, so no client waits on the copy.
+
+void MaybeCompactDocument()
+{
+    const std::lock_guard<std::mutex> lock(docMutex);
+
+    size_t used = doc.GetAllocator().Size();
+    size_t live = used > deadBytes ? used - deadBytes : 0;
+
+    if(DocAllocator::kNeedFree)
+        return;
+    if(deadBytes < SettingAsDouble("compactminbytes", DEFAULT_COMPACT_MINBYTES))
+        return;
+    if(deadBytes < SettingAsDouble("compactratio", DEFAULT_COMPACT_RATIO) * live)
+        return;
 
+    CompactDocument();
+    std::cerr << "Compacted document pool from " << used << " to " << doc.GetAllocator().Size() << " bytes" << std::endl;
+}
 
 // -----------------------------------------------------------------------------
 
-rapidjson::Value &JsonMergePatch(rapidjson::Value &target, rapidjson::Value &patch)
-{ 
-    if(!patch.IsObject()) 
-        return patch;
+// Removes the nodes whose TTL ran out, 'expirebatch' at a time, each batch in
+// its own critical section, then the elements of capped arrays past their
+// 'maxage'. Run before every request, so no request sees an expired node; the
+// cost is the number of nodes that expire, not the number with a TTL.
 
-    if(!target.IsObject()) 
-        target.SetObject();
+void ExpireNodes()
+{
+    size_t batch = std::max<size_t>(1, (size_t)SettingAsDouble("expirebatch", DEFAULT_EXPIRE_BATCH));
+    bool more = true;
+    while(more)
+    {
+        const std::lock_guard<std::mutex> lock(docMutex);
+        expiryWheel.Advance(UnixSeconds());
 
-    for(auto p = patch.MemberBegin(); p != patch.MemberEnd(); ++p) 
-        if(p->value.IsNull())
-            target.RemoveMember(p->name);
-        else if(target.HasMember(p->name)) 
-            target[p->name] = JsonMergePatch(target[p->name], p->value);
-        else
-            target.AddMember(p->name, p->value, doc.GetAllocator());
-    return target;
+        std::vector<TimerWheel<std::string>::Entry> expired;
+        more = expiryWheel.TakeDue(expired, batch);
+        for(const TimerWheel<std::string>::Entry &entry : expired)
+        {
+            // Cancelled or reset since.
+            auto e = expiries.find(entry.first);
+            if(e == expiries.end() || e->second != entry.second)
+                continue;
+            ClearExpiries(entry.first);
+
+            // A write may have put an array on the way since.
+            JsonPointer ptr(entry.first.c_str(), entry.first.size());
+            if(!Expirable(ptr) || !EraseByPointer(doc, ptr))
+                continue;
+
+            pathVersions.Touch(VersionPath(ptr.GetTokens(), ptr.GetTokenCount()));
+            InvalidateBelow(CanonicalPath(ptr.GetTokens(), ptr.GetTokenCount() - 1));
+            NormalizeCappedArrays(CanonicalPath(ptr.GetTokens(), ptr.GetTokenCount()));
+            lastModified = local_clock::now();
+            std::cerr << "Expired " << entry.first << std::endl;
+        }
+    }
+
+    // Elements of capped arrays run out of time the same way.
+    const std::lock_guard<std::mutex> lock(docMutex);
+    uint64_t now = UnixSeconds();
+    for(auto &entry : cappedArrays)
+    {
+        CappedArray &capped = entry.second;
+        if(capped.maxAge && !capped.appended.empty() && capped.appended.front() + capped.maxAge <= now)
+        {
+            NormalizeCappedArray(capped, now);
+            lastModified = local_clock::now();
+        }
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -118,6 +1660,86 @@ bool ReadSettingsFromFile()
 }
 
 
+// -----------------------------------------------------------------------------
+
+// Reads "cappedarrays" from the settings: an object mapping the pointers of
+// arrays to their "maxlength" and "maxage" in seconds.
+
+void LoadCappedArrays()
+{
+    auto m = settings.IsObject() ? settings.FindMember("cappedarrays") : settings.MemberEnd();
+    if(!settings.IsObject() || m == settings.MemberEnd() || !m->value.IsObject())
+        return;
+
+    for(auto a = m->value.MemberBegin(); a != m->value.MemberEnd(); ++a)
+    {
+        JsonPointer pointer(a->name.GetString(), a->name.GetStringLength());
+        if(!pointer.IsValid() || !a->value.IsObject())
+        {
+            std::cerr << "Ignoring capped array " << a->name.GetString() << std::endl;
+            continue;
+        }
+
+        CappedArray capped;
+        capped.canonical = CanonicalPath(pointer.GetTokens(), pointer.GetTokenCount());
+        capped.path      = VersionPath(pointer.GetTokens(), pointer.GetTokenCount());
+        capped.pointer   = pointer;
+        auto limit = a->value.FindMember("maxlength");
+        if(limit != a->value.MemberEnd() && limit->value.IsUint64())
+            capped.maxLength = (size_t)limit->value.GetUint64();
+        limit = a->value.FindMember("maxage");
+        if(limit != a->value.MemberEnd() && limit->value.IsUint64())
+            capped.maxAge = limit->value.GetUint64();
+        cappedArrays[capped.canonical] = capped;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// The TTLs live next to the data file, in an object mapping the pointers of
+// the nodes to their deadlines. Caller holds docMutex.
+
+void UnSerializeExpiries()
+{
+    std::ifstream in(settings["datafile"].GetString() + std::string(".ttl"));
+    if(!in.is_open())
+        return;
+
+    rapidjson::Document ttl;
+    rapidjson::IStreamWrapper isw(in);
+    ttl.ParseStream(isw);
+    if(ttl.HasParseError() || !ttl.IsObject())
+    {
+        std::cerr << "Parse errors in the TTL file" << std::endl;
+        return;
+    }
+    for(auto m = ttl.MemberBegin(); m != ttl.MemberEnd(); ++m)
+    {
+        if(m->value.IsUint64())
+            SetExpiry(std::string(m->name.GetString(), m->name.GetStringLength()), m->value.GetUint64());
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool SerializeExpiries()
+{
+    std::ofstream ofs(settings["datafile"].GetString() + std::string(".ttl"));
+    if(!ofs.is_open())
+        return false;
+
+    rapidjson::OStreamWrapper osw(ofs);
+    rapidjson::PrettyWriter<rapidjson::OStreamWrapper> writer(osw);
+    writer.StartObject();
+    for(const auto &entry : expiries)
+    {
+        writer.Key(entry.first.c_str(), (rapidjson::SizeType)entry.first.size());
+        writer.Uint64(entry.second);
+    }
+    writer.EndObject();
+    return true;
+}
+
 // -----------------------------------------------------------------------------
 
 bool UnSerializeFromFile() 
@@ -134,6 +1756,7 @@ bool UnSerializeFromFile()
             return false;
         }
         lastModified =  local_clock::now();
+        UnSerializeExpiries();
         return true;
     }
     return false;
@@ -147,10 +1770,11 @@ bool SerializeToFile()
     std::ofstream ofs(settings["datafile"].GetString());
     if(ofs.is_open()) 
     {
+        FindRings();
         rapidjson::OStreamWrapper osw(ofs);
         rapidjson::PrettyWriter<rapidjson::OStreamWrapper> writer(osw);
-        doc.Accept(writer);
-        return true;
+        WriteJson(doc, writer);
+        return SerializeExpiries();
     }
     
     return false;
@@ -177,6 +1801,71 @@ void AddETagFromBuffer(rapidjson::StringBuffer &buffer)
 
 // -----------------------------------------------------------------------------
 
+void AppendRaw(rapidjson::StringBuffer &buffer, const char *text)
+{
+    for(; *text; ++text)
+        buffer.Put(*text);
+}
+
+// -----------------------------------------------------------------------------
+
+void AddETag(const std::string &etag)
+{
+    if(!etag.empty())
+        std::cout << "ETag: " << etag << "\r\n";
+}
+
+// -----------------------------------------------------------------------------
+
+// Evaluates the If-Match and If-None-Match headers of 'req' against 'etag',
+// empty when the target doesn't exist, and answers for a failed one. 'read'
+// is true for GET and HEAD. Returns whether the request should go on.
+
+bool PreconditionsHold(FCGX_Request &req, const std::string &etag, bool read)
+{
+    switch(EvaluatePreconditions(FCGX_GetParam("HTTP_IF_MATCH", req.envp), FCGX_GetParam("HTTP_IF_NONE_MATCH", req.envp), etag, read))
+    {
+        case PRECONDITION_HOLDS:
+            return true;
+        case PRECONDITION_NOT_MODIFIED:
+            std::cout << NOT_MODIFIED_HEADER;
+            AddETag(etag);
+            std::cout << END_HEADERS;
+            return false;
+        case PRECONDITION_FAILED:
+            break;
+    }
+    std::cout << PRECONDITION_FAILED_HEADER << END_HEADERS;
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+
+// The X-Expire-After header of a PUT or PATCH: the whole number of seconds
+// after which the node at 'ptr' expires, or 0 without the header. Answers
+// 400 and returns false for a malformed value or a node that can't be given
+// a TTL; see Expirable().
+
+bool ExpireAfter(FCGX_Request &req, const JsonPointer &ptr, uint64_t &seconds)
+{
+    seconds = 0;
+    const char *header = FCGX_GetParam("HTTP_X_EXPIRE_AFTER", req.envp);
+    if(!header)
+        return true;
+
+    char *end = 0;
+    seconds = strtoull(header, &end, 10);
+    if(!isdigit((unsigned char)*header) || *end || seconds == 0 || seconds > MAX_EXPIRE_AFTER || !Expirable(ptr))
+    {
+        std::cerr << "Cannot expire a node after '" << header << "'" << std::endl;
+        std::cout << CLIENT_ERROR_HEADER << END_HEADERS;
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
 void AddJsonFromBuffer(rapidjson::StringBuffer &buffer)
 {
     std::cout << CONTENT_DISPOSITION_HEADER << JSON_HEADER << END_HEADERS << buffer.GetString();
@@ -192,16 +1881,20 @@ void HandleFCGIGet(const char *path, FCGX_Request &req)
     AddLastModifiedHeader();
 
     // first try to find the node:
-    rapidjson::Pointer ptr(path);
-    rapidjson::Value *currentNode = rapidjson::GetValueByPointer(doc, ptr);
-    if(currentNode && !currentNode->IsNull()) 
+    CompiledPointer &compiled = CompilePointer(path);
+    JsonValue *currentNode = Resolve(compiled);
+    std::string etag = VersionETag(currentNode, compiled.path);
+    if(!PreconditionsHold(req, etag, true))
+        return;
+
+    if(!etag.empty()) 
     {
         try 
         {
             rapidjson::StringBuffer buffer;
             rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);                
-            currentNode->Accept(writer);
-            AddETagFromBuffer(buffer);
+            WriteJson(*currentNode, writer);
+            AddETag(etag);
             AddJsonFromBuffer(buffer);
         }
         catch(std::exception const &e)  
@@ -236,11 +1929,12 @@ void HandleFCGIPatch(const char *path, FCGX_Request &req)
     
     bool isJson           = (contentType == "application/json");
     bool isJsonMergePatch = (contentType == "application/merge-patch+json");
+    bool isJsonPatch      = (contentType == "application/json-patch+json");
 
-    if(!isJson and !isJsonMergePatch) 
+    if(!isJson and !isJsonMergePatch and !isJsonPatch) 
     {
         // RETURN PARSE ERROR HEADERS.
-        std::cerr << "PATCH Input is neither json or merge-patch json but '" << contentType << "'" << std::endl;
+        std::cerr << "PATCH Input is neither json, merge-patch json or json patch but '" << contentType << "'" << std::endl;
         try 
         {
             std::cout << INCORRECT_PATCH_MEDIA_TYPE << END_HEADERS;
@@ -252,70 +1946,91 @@ void HandleFCGIPatch(const char *path, FCGX_Request &req)
         return;        
     }
 
-    rapidjson::Document incoming(&doc.GetAllocator());
-    rapidjson::IStreamWrapper isw(std::cin);
-    incoming.ParseStream(isw); 
-    
-    if(incoming.HasParseError()) 
-    {
-        // RETURN PARSE ERROR HEADERS.
-        try 
-        {
-            std::cout << CLIENT_ERROR_HEADER << END_HEADERS;
-        }
-        catch(std::exception const &e)  
-        {
-            std::cerr << "Exception when returning Client Error." << e.what() << std::endl;
-        }      
+    // Try to find the node:
+    CompiledPointer &compiled = CompilePointer(path);
+    JsonValue *currentNode = Resolve(compiled);
+
+    // Mid-air collision prevention:
+    if(!PreconditionsHold(req, VersionETag(currentNode, compiled.path), false))
         return;
 
-    }
-    // Try to find the node:
-    rapidjson::Pointer ptr(path);
-    rapidjson::Value *currentNode = rapidjson::GetValueByPointer(doc, ptr);
     if(currentNode) 
     {
-        try 
+        uint64_t expireAfter;
+        if(!ExpireAfter(req, compiled.pointer, expireAfter))
+            return;
+
+        rapidjson::Document incoming(&requestAllocator);
+        rapidjson::IStreamWrapper isw(std::cin);
+        incoming.ParseStream(isw); 
+        bool parsed = !incoming.HasParseError() && (!isJsonPatch || ValidJsonPatch(incoming));
+
+        if(!parsed) 
         {
-            // Mid-air collision prevention:
-            const char *http_if_match = FCGX_GetParam("HTTP_IF_MATCH", req.envp);
-            if(http_if_match) 
+            // RETURN PARSE ERROR HEADERS.
+            try 
             {
-                rapidjson::StringBuffer buffer;
-                rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);                
-                currentNode->Accept(writer);
-                unsigned char result[MD5_DIGEST_LENGTH];    
-                MD5((const unsigned char*)(buffer.GetString()), buffer.GetSize(), result);
-
-                std::stringstream oss;    
-                oss << "\"";
-                base64_encode(result, MD5_DIGEST_LENGTH, oss);
-                oss << "\"";
-                
-                if(std::string(http_if_match) != oss.str())
-                {
-                    std::cout << PRECONDITION_FAILED_HEADER << END_HEADERS;
-                    return;
-                }
+                std::cout << CLIENT_ERROR_HEADER << END_HEADERS;
             }
+            catch(std::exception const &e)  
+            {
+                std::cerr << "Exception when returning Client Error." << e.what() << std::endl;
+            }      
+            return;
+        }
 
+        try 
+        {
             // if the If-Unmodified-Since header is present, we must:
             //   convert the incoming header to a time_point 
             //   reject with 412 Precondition Failed if our modified time is newer.
             //   NOTE: the modified timestamp is not granular - it is for the whole store.
             
             if(isJsonMergePatch) 
-                JsonMergePatch(*currentNode, incoming);
+            {
+                std::vector<PathVersions::Path> changed;
+                PathVersions::Path at;
+                JsonMergePatch(*currentNode, incoming, doc.GetAllocator(), at, &changed);
+                NoteChanged(compiled, changed);
+                for(const PathVersions::Path &relative : changed)
+                    ClearExpiries(CanonicalPath(compiled.canonical, relative));
+            }
+            else if(isJsonPatch)
+            {
+                // All operations or none; a failed one leaves the node as it was.
+                std::vector<std::string> replaced;
+                int failed = JsonPatch(*currentNode, compiled.path, incoming, replaced, doc.GetAllocator());
+                InvalidateBelow(compiled.canonical);
+                if(failed >= 0)
+                {
+                    std::cerr << "JSON Patch operation " << failed << " failed, patch not applied" << std::endl;
+                    std::cout << CONFLICT_HEADER << END_HEADERS;
+                    return;
+                }
+                for(const std::string &relative : replaced)
+                    ClearExpiries(compiled.canonical + relative);
+            }
             else
-                currentNode->Swap(incoming);    
+            {
+                RetireValue(*currentNode);
+                currentNode->CopyFrom(incoming, doc.GetAllocator());    
+                pathVersions.Touch(compiled.path);
+                InvalidateBelow(compiled.canonical);
+                ClearExpiries(compiled.canonical);
+            }
+
+            // A PATCH keeps the TTL of the node unless it replaces the node
+            // whole or sets a new one.
+            if(expireAfter)
+                SetExpiry(compiled.canonical, UnixSeconds() + expireAfter);
             
             lastModified =  local_clock::now();
             AddLastModifiedHeader();
             
             rapidjson::StringBuffer buffer;
             rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);                
-            currentNode->Accept(writer);
-            AddETagFromBuffer(buffer);
+            WriteJson(*currentNode, writer);
+            AddETag(VersionETag(currentNode, compiled.path));
             AddJsonFromBuffer(buffer);
         }
         catch(std::exception const &e)  
@@ -362,7 +2077,7 @@ void HandleFCGIPut(const char *path, FCGX_Request &req)
         return;        
     }
     // Retrieve the payload
-    rapidjson::Document incoming(&doc.GetAllocator());
+    rapidjson::Document incoming(&requestAllocator);
     rapidjson::IStreamWrapper isw(std::cin);
     incoming.ParseStream(isw); 
 
@@ -383,8 +2098,36 @@ void HandleFCGIPut(const char *path, FCGX_Request &req)
     else 
     {
         // Try to find the node:
-        rapidjson::Pointer ptr(path);
-        rapidjson::Value &currentNode = rapidjson::SetValueByPointer(doc, ptr, incoming);    
+        CompiledPointer &compiled = CompilePointer(path);
+        const JsonPointer &ptr = compiled.pointer;
+        if(!ptr.IsValid())
+        {
+            std::cout << CLIENT_ERROR_HEADER << END_HEADERS;
+            return;
+        }
+
+        uint64_t expireAfter;
+        if(!ExpireAfter(req, ptr, expireAfter))
+            return;
+
+        size_t existing = 0;
+        JsonValue *previous = FindByTokens(doc, ptr.GetTokens(), ptr.GetTokenCount(), &existing);
+        if(!PreconditionsHold(req, VersionETag(previous, compiled.path), false))
+            return;
+        if(previous)
+            RetireValue(*previous);
+        JsonValue committed(incoming, doc.GetAllocator());
+        JsonValue *appended = AppendToCappedArray(compiled, committed);
+        JsonValue &currentNode = appended ? *appended : CreateByPointer(doc, ptr, doc.GetAllocator());
+        if(!appended)
+            currentNode = committed;
+        pathVersions.Touch(compiled.path);
+        InvalidateBelow(CanonicalPath(ptr.GetTokens(), existing));
+
+        // The new value starts without TTLs but the one it was sent with.
+        ClearExpiries(compiled.canonical);
+        if(expireAfter)
+            SetExpiry(compiled.canonical, UnixSeconds() + expireAfter);
         lastModified =  local_clock::now();            
         try 
         {            
@@ -392,8 +2135,8 @@ void HandleFCGIPut(const char *path, FCGX_Request &req)
 
             rapidjson::StringBuffer buffer;
             rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);                
-            currentNode.Accept(writer);
-            AddETagFromBuffer(buffer);
+            WriteJson(currentNode, writer);
+            AddETag(VersionETag(&currentNode, compiled.path));
             AddJsonFromBuffer(buffer);
         }
         catch(std::exception const &e)  
@@ -409,10 +2152,24 @@ void HandleFCGIDelete(const char *path, FCGX_Request &req)
 {
     // Let's get the document 
     const std::lock_guard<std::mutex> lock(docMutex);
-    rapidjson::Pointer ptr(path);    
-    
-    if(rapidjson::EraseValueByPointer(doc, ptr))
+    CompiledPointer &compiled = CompilePointer(path);
+    const JsonPointer &ptr = compiled.pointer;
+
+    if(!PreconditionsHold(req, VersionETag(Resolve(compiled), compiled.path), false))
+        return;
+
+    // Erasing an element shifts the ones after it, which changes the array.
+    size_t count = ptr.GetTokenCount();
+    JsonValue *parent = count ? FindByTokens(doc, ptr.GetTokens(), count - 1) : 0;
+    PathVersions::Path touched = compiled.path;
+    if(parent && parent->IsArray() && touched.size() == count)
+        touched.pop_back();
+
+    if(EraseByPointer(doc, ptr))
     {
+        ClearExpiries(compiled.canonical);
+        pathVersions.Touch(touched);
+        InvalidateBelow(CanonicalPath(ptr.GetTokens(), ptr.GetTokenCount() - 1));
         lastModified =  local_clock::now();
         AddLastModifiedHeader();
         std::cout << JSON_HEADER << END_HEADERS << "true";
@@ -432,17 +2189,17 @@ void HandleFCGIHead(const char *path, FCGX_Request &req)
     
     AddLastModifiedHeader();
 
-    // first try to find the node:
-    rapidjson::Pointer ptr(path);
-    rapidjson::Value *currentNode = rapidjson::GetValueByPointer(doc, ptr);
-    if(currentNode && !currentNode->IsNull()) 
+    // first try to find the node; the ETag needs no serialization:
+    CompiledPointer &compiled = CompilePointer(path);
+    std::string etag = VersionETag(Resolve(compiled), compiled.path);
+    if(!PreconditionsHold(req, etag, true))
+        return;
+
+    if(!etag.empty()) 
     {
         try 
         {
-            rapidjson::StringBuffer buffer;
-            rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);                
-            currentNode->Accept(writer);
-            AddETagFromBuffer(buffer);
+            AddETag(etag);
             std::cout << CONTENT_DISPOSITION_HEADER << JSON_HEADER << END_HEADERS;
         }
         catch(std::exception const &e)  
@@ -465,6 +2222,253 @@ void HandleFCGIHead(const char *path, FCGX_Request &req)
 
 // -----------------------------------------------------------------------------
 
+// Appends an array with an object for each of 'pointers', JSON Pointer
+// strings relative to 'base', in turn: the "pointer", a "status" of 200, 404
+// or 400 (for a pointer that doesn't parse) and, when found, the node's
+// "value" and "etag". Values are written straight into 'buffer', and each
+// item's ETag is the one a GET of it would return. Caller holds docMutex.
+
+void AppendBatch(rapidjson::StringBuffer &buffer, const std::string &base, const std::vector<std::string> &pointers)
+{
+    buffer.Put('[');
+    for(size_t i = 0; i < pointers.size(); ++i)
+    {
+        const std::string &item = pointers[i];
+        bool relative = item.empty() || item[0] == '/';
+
+        AppendRaw(buffer, i ? ",\n    { \"pointer\" : " : "\n    { \"pointer\" : ");
+        rapidjson::Writer<rapidjson::StringBuffer> name(buffer);
+        name.String(item.c_str(), (rapidjson::SizeType)item.size());
+
+        CompiledPointer &compiled = CompilePointer((base + item).c_str());
+        bool parsed = relative && compiled.pointer.IsValid();
+        JsonValue *node = parsed ? Resolve(compiled) : 0;
+        if(!parsed)
+            AppendRaw(buffer, ", \"status\" : 400 }");
+        else if(!node || node->IsNull())
+            AppendRaw(buffer, ", \"status\" : 404 }");
+        else
+        {
+            AppendRaw(buffer, ", \"status\" : 200, \"value\" : ");
+            rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+            WriteJson(*node, writer);
+            AppendRaw(buffer, ", \"etag\" : ");
+            std::string etag = VersionETag(node, compiled.path);
+            rapidjson::Writer<rapidjson::StringBuffer> tag(buffer);
+            tag.String(etag.c_str(), (rapidjson::SizeType)etag.size());
+            AppendRaw(buffer, " }");
+        }
+    }
+    AppendRaw(buffer, pointers.empty() ? "]" : "\n]");
+}
+
+// -----------------------------------------------------------------------------
+
+// Reads several nodes in one request. The body is an array of JSON Pointers,
+// relative to 'path', answered as by AppendBatch(). All nodes are read under
+// the one lock, so the answer is a consistent view; the ETag of the response
+// covers them all.
+
+void HandleFCGIBatch(const char *path, FCGX_Request &req)
+{
+    rapidjson::Document incoming(&requestAllocator);
+    rapidjson::IStreamWrapper isw(std::cin);
+    incoming.ParseStream(isw);
+
+    bool valid = !incoming.HasParseError() && incoming.IsArray();
+    std::vector<std::string> pointers;
+    for(rapidjson::SizeType i = 0; valid && i < incoming.Size(); ++i)
+    {
+        valid = incoming[i].IsString();
+        if(valid)
+            pointers.emplace_back(incoming[i].GetString(), incoming[i].GetStringLength());
+    }
+    if(!valid)
+    {
+        std::cerr << "Batch to '" << std::string(path) << "' is not an array of pointers." << std::endl;
+        std::cout << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
+
+    const std::lock_guard<std::mutex> lock(docMutex);
+
+    rapidjson::StringBuffer buffer;
+    AppendBatch(buffer, path, pointers);
+
+    AddLastModifiedHeader();
+    AddETagFromBuffer(buffer);
+    AddJsonFromBuffer(buffer);
+}
+
+// -----------------------------------------------------------------------------
+
+// Applies a transaction, see ValidTransaction(), to the node at 'path':
+//
+//     { "preconditions" : [ { "pointer" : "/from", "etag" : "\"...\"" } ],
+//       "operations"    : [ { "op" : "delete", "pointer" : "/from/3" },
+//                           { "op" : "put",    "pointer" : "/to/-", "value" : 7 } ] }
+//
+// Pointers are relative to 'path'. Preconditions are checked and operations
+// applied in the one critical section: if a precondition doesn't hold nothing
+// is done and 412 is returned, if an operation fails the ones before it are
+// taken back and 409 is returned. Otherwise the answer is the nodes the
+// operations wrote to as they are after the transaction, as for a batch read,
+// so an increment answers with the new count and an append with the index the
+// value landed at.
+
+void HandleFCGITransaction(const char *path, FCGX_Request &req)
+{
+    rapidjson::Document incoming(&requestAllocator);
+    rapidjson::IStreamWrapper isw(std::cin);
+    incoming.ParseStream(isw);
+
+    if(incoming.HasParseError() || !ValidTransaction(incoming))
+    {
+        std::cerr << "Transaction to '" << std::string(path) << "' is not valid." << std::endl;
+        std::cout << CLIENT_ERROR_HEADER << END_HEADERS;
+        return;
+    }
+
+    const std::lock_guard<std::mutex> lock(docMutex);
+
+    CompiledPointer &compiled = CompilePointer(path);
+    JsonValue *currentNode = Resolve(compiled);
+    if(!currentNode)
+    {
+        std::cout << NOT_FOUND_HEADER << END_HEADERS;
+        return;
+    }
+
+    if(incoming.HasMember("preconditions"))
+    {
+        int failed = FailedPrecondition(*currentNode, compiled.path, incoming["preconditions"]);
+        if(failed >= 0)
+        {
+            std::cerr << "Transaction precondition " << failed << " doesn't hold, nothing applied" << std::endl;
+            std::cout << PRECONDITION_FAILED_HEADER << END_HEADERS;
+            return;
+        }
+    }
+
+    std::vector<std::string> written, replaced;
+    int failed = Transact(*currentNode, compiled.path, incoming["operations"], written, replaced, doc.GetAllocator());
+    InvalidateBelow(compiled.canonical);
+    if(failed >= 0)
+    {
+        std::cerr << "Transaction operation " << failed << " failed, nothing applied" << std::endl;
+        std::cout << CONFLICT_HEADER << END_HEADERS;
+        return;
+    }
+    for(const std::string &relative : replaced)
+        ClearExpiries(compiled.canonical + relative);
+    lastModified = local_clock::now();
+
+    rapidjson::StringBuffer buffer;
+    AppendBatch(buffer, path, written);
+
+    AddLastModifiedHeader();
+    AddETagFromBuffer(buffer);
+    AddJsonFromBuffer(buffer);
+}
+
+// -----------------------------------------------------------------------------
+
+// Runs the JSONPath query in the body against the node at 'path'. Matches are
+// written straight from the document into the response, as an array in
+// document order.
+
+void HandleFCGIPost(const char *path, FCGX_Request &req)
+{
+    const char *type = FCGX_GetParam("CONTENT_TYPE", req.envp);
+    std::string contentType(type ? type : "");
+    if(contentType == BATCH_MEDIA_TYPE)
+    {
+        HandleFCGIBatch(path, req);
+        return;
+    }
+    if(contentType == TRANSACTION_MEDIA_TYPE)
+    {
+        HandleFCGITransaction(path, req);
+        return;
+    }
+    if(contentType != "application/jsonpath")
+    {
+        std::cerr << std::string("POST input is not a query but ") + contentType;
+        std::cout << INCORRECT_POST_MEDIA_TYPE << END_HEADERS;
+        return;
+    }
+
+    std::istreambuf_iterator<char> begin(std::cin), end;
+    std::string text(begin, end);
+
+    const std::lock_guard<std::mutex> lock(docMutex);
+
+    PathQuery<JsonValue> *query = queryCache.Find(text);
+    if(!query)
+    {
+        PathQuery<JsonValue> compiled;
+        std::string error;
+        if(!compiled.Compile(text, error))
+        {
+            std::cerr << "Bad query: " << error << std::endl;
+            std::cout << CLIENT_ERROR_HEADER << END_HEADERS;
+            return;
+        }
+        query = &queryCache.Insert(text, std::move(compiled));
+    }
+
+    JsonValue *currentNode = Resolve(CompilePointer(path));
+    if(!currentNode)
+    {
+        std::cout << NOT_FOUND_HEADER << END_HEADERS;
+        return;
+    }
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.StartArray();
+    query->Evaluate(*currentNode, 
+        [&writer](JsonValue &match) 
+        { 
+            WriteJson(match, writer); 
+        },
+        [](JsonValue &object, const std::string &name) -> JsonValue *
+        {
+            auto m = objectIndex.FindMember(object, name.c_str(), (rapidjson::SizeType)name.size());
+            return m == object.MemberEnd() ? 0 : &m->value;
+        },
+        [](JsonValue &array, rapidjson::SizeType i) -> JsonValue &
+        {
+            return array[RingPosition(array, i)];
+        });
+    writer.EndArray();
+
+    AddLastModifiedHeader();
+    AddETagFromBuffer(buffer);
+    AddJsonFromBuffer(buffer);
+}
+
+// -----------------------------------------------------------------------------
+
+// Administrative requests live under ADMIN_PATH:
+//   POST /_admin/compact   compacts the document pool right away.
+
+void HandleFCGIAdmin(const std::string &command, const std::string &method, FCGX_Request &req)
+{
+    if(command == "/compact" && method == "POST")
+    {
+        const std::lock_guard<std::mutex> lock(docMutex);
+        size_t before = doc.GetAllocator().Size();
+        CompactDocument();
+        std::cout << JSON_HEADER << END_HEADERS 
+                  << "{ \"before\" : " << before << ", \"after\" : " << doc.GetAllocator().Size() << " }";
+        return;
+    }
+    std::cout << NOT_FOUND_HEADER << END_HEADERS;
+}
+
+// -----------------------------------------------------------------------------
+
 extern "C" void sighandler(int sig_no)
 {   
     switch(sig_no) {
@@ -508,7 +2512,19 @@ int main(void)
     sigaction(SIGTERM, &new_action, &old_action);
     sigaction(SIGHUP, &new_action, &old_action);
 
+    objectIndex.SetThreshold((rapidjson::SizeType)SettingAsDouble("indexthreshold", 0));
+    pointerCache.SetCapacity((size_t)SettingAsDouble("pointercache", DEFAULT_POINTER_CACHE));
+    queryCache.SetCapacity((size_t)SettingAsDouble("querycache", DEFAULT_QUERY_CACHE));
+    LoadCappedArrays();
+
+    // Versions start over with every run; the epoch keeps their ETags apart.
+    epoch = std::chrono::duration_cast<std::chrono::microseconds>(local_clock::now().time_since_epoch()).count();
+
+    // The wheel's clock starts now, before the saved TTLs are scheduled.
+    expiryWheel.Advance(UnixSeconds());
+
     UnSerializeFromFile(); 
+    NormalizeCappedArrays("");
 
     std::streambuf * cin_streambuf  = std::cin.rdbuf();
     std::streambuf * cout_streambuf = std::cout.rdbuf();
@@ -543,18 +2559,52 @@ int main(void)
 
         // char **env = req.envp; while (*(++env)) puts(*env);
 
-        if     (method == "GET"   )  HandleFCGIGet(pi, request);
+        std::string pathInfo(pi ? pi : "");
+
+        ExpireNodes();
+
+        // Writes that may reach a capped array see it as a plain array, and
+        // it is trimmed to its limits after them. Appends to it find it as
+        // the last one left it, as a ring, and reads follow the ring.
+        const char *type = FCGX_GetParam("CONTENT_TYPE", request.envp);
+        bool transaction = method == "POST" && type && type == TRANSACTION_MEDIA_TYPE;
+        CompiledPointer &compiled = CompilePointer(pi);
+        bool write = (method == "PUT" || method == "PATCH" || method == "DELETE" || transaction)
+                  && !(method == "PUT" && CappedAppendTarget(compiled));
+        std::string canonical = compiled.canonical;
+        {
+            const std::lock_guard<std::mutex> lock(docMutex);
+            if(write)
+                NormalizeCappedArrays(canonical);
+            FindRings();
+        }
+
+        if(pathInfo == ADMIN_PATH || pathInfo.compare(0, ADMIN_PATH.size() + 1, ADMIN_PATH + "/") == 0)  
+            HandleFCGIAdmin(pathInfo.substr(ADMIN_PATH.size()), method, request);
+        else if(method == "GET"   )  HandleFCGIGet(pi, request);
         else if(method == "PATCH" )  HandleFCGIPatch(pi, request);
         else if(method == "PUT"   )  HandleFCGIPut(pi, request);                    
         else if(method == "DELETE")  HandleFCGIDelete(pi, request);
         else if(method == "HEAD"  )  HandleFCGIHead(pi, request);
+        else if(method == "POST"  )  HandleFCGIPost(pi, request);
         else  
         {
             std::cout << METHOD_ERROR_HEADER << JSON_HEADER << END_HEADERS << METHOD_ERROR_BODY;
             std::cerr << "Method " << method << " not allowed from " << std::string(FCGX_GetParam("REMOTE_ADDR", request.envp));
         }
         
+        if(write)
+        {
+            const std::lock_guard<std::mutex> lock(docMutex);
+            NormalizeCappedArrays(canonical);
+        }
+
         FCGX_Finish_r(&request);
+
+        // Drop whatever the request parsed; the arena's buffer is reused.
+        requestAllocator.Clear();
+
+        MaybeCompactDocument();
     }
     close(sock);
 
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Aggregates over the elements of an array: count, sum, min, max and average
+// of a numeric field, optionally grouped by a string field.
+//
+// Fields are JSON Pointers into each element, passed as their tokens. With no
+// field the elements are only counted; with a field only elements where it is
+// a number count. Elements whose group field is missing or not a string are
+// left out of the groups.
+//
+// Integers are summed exactly in 64 bits until a sum would overflow, after
+// which it continues in floating point; that is the type-specialized path,
+// without converting every value to a double or going through a visitor.
+// -----------------------------------------------------------------------------
+
+template <class Json>
+class Aggregation
+{
+public:
+    Aggregation(bool hasField, std::vector<std::string> field, bool hasGroup, std::vector<std::string> group) :
+        hasField(hasField),
+        field(std::move(field)),
+        hasGroup(hasGroup),
+        group(std::move(group)) {}
+
+    // One pass over 'array'.
+    void Run(const Json &array)
+    {
+        for(const Json &element : array.array_range())
+            Add(element);
+    }
+
+    // Adds one more element, e.g. one appended to the array.
+    void Add(const Json &element)
+    {
+        Stats *stats = &total;
+        if(hasGroup)
+        {
+            const Json *key = Follow(element, group);
+            if(key && key->is_string())
+                stats = &groups[key->template as<std::string>()];
+            else
+                stats = 0;
+        }
+
+        if(!hasField)
+        {
+            ++total.count;
+            if(stats && stats != &total)
+                ++stats->count;
+            return;
+        }
+
+        const Json *value = Follow(element, field);
+        if(!value)
+            return;
+
+        if(value->is_int64())
+        {
+            int64_t number = value->template as<int64_t>();
+            total.Add(number);
+            if(stats && stats != &total)
+                stats->Add(number);
+        }
+        else if(value->is_number())
+        {
+            double number = value->template as<double>();
+            total.Add(number);
+            if(stats && stats != &total)
+                stats->Add(number);
+        }
+    }
+
+    // Forgets everything added so far.
+    void Clear()
+    {
+        total = Stats();
+        groups.clear();
+    }
+
+    // The result, as an object with "count" and, with a field, "sum", "min",
+    // "max" and "avg", plus "groups" mapping each group to the same.
+    Json Result() const
+    {
+        Json result = total.ToJson(hasField);
+        if(hasGroup)
+        {
+            Json byGroup;
+            for(const auto &entry : groups)
+                byGroup.insert_or_assign(entry.first, entry.second.ToJson(hasField));
+            result.insert_or_assign("groups", std::move(byGroup));
+        }
+        return result;
+    }
+
+private:
+    struct Stats
+    {
+        size_t  count = 0;
+        bool    integral = true;    // every value so far was an integer and
+        int64_t integerSum = 0;     // their sum fits in integerSum
+        double  sum = 0;
+        double  min = std::numeric_limits<double>::infinity();
+        double  max = -std::numeric_limits<double>::infinity();
+        int64_t integerMin = std::numeric_limits<int64_t>::max();
+        int64_t integerMax = std::numeric_limits<int64_t>::min();
+
+        void Add(int64_t number)
+        {
+            ++count;
+            int64_t next;
+            if(integral && !__builtin_add_overflow(integerSum, number, &next))
+                integerSum = next;
+            else
+            {
+                if(integral)
+                {
+                    integral = false;
+                    sum = (double)integerSum;
+                }
+                sum += (double)number;
+            }
+            if(number < integerMin)
+                integerMin = number;
+            if(number > integerMax)
+                integerMax = number;
+            MinMax((double)number);
+        }
+
+        void Add(double number)
+        {
+            ++count;
+            if(integral)
+            {
+                integral = false;
+                sum = (double)integerSum;
+            }
+            sum += number;
+            MinMax(number);
+        }
+
+        void MinMax(double number)
+        {
+            if(number < min)
+                min = number;
+            if(number > max)
+                max = number;
+        }
+
+        Json ToJson(bool numeric) const
+        {
+            Json result;
+            result.insert_or_assign("count", Json(static_cast<uint64_t>(count)));
+            if(!numeric)
+                return result;
+
+            if(integral)
+                result.insert_or_assign("sum", Json(integerSum));
+            else
+                result.insert_or_assign("sum", Json(sum));
+
+            if(count == 0)
+            {
+                result.insert_or_assign("min", Json::null());
+                result.insert_or_assign("max", Json::null());
+                result.insert_or_assign("avg", Json::null());
+                return result;
+            }
+
+            // Integral extremes go out as integers, as they came in.
+            if(integral)
+            {
+                result.insert_or_assign("min", Json(integerMin));
+                result.insert_or_assign("max", Json(integerMax));
+            }
+            else
+            {
+                result.insert_or_assign("min", Json(min));
+                result.insert_or_assign("max", Json(max));
+            }
+            result.insert_or_assign("avg", Json((integral ? (double)integerSum : sum) / count));
+            return result;
+        }
+    };
+
+    // -------------------------------------------------------------------------
+
+    // Follows pointer tokens from 'value' without parsing a pointer per
+    // element. Null when the path doesn't exist.
+    static const Json *Follow(const Json &value, const std::vector<std::string> &tokens)
+    {
+        const Json *current = &value;
+        for(const std::string &token : tokens)
+        {
+            if(current->is_object())
+            {
+                auto member = current->find(token);
+                if(member == current->object_range().end())
+                    return 0;
+                current = &member->value();
+            }
+            else if(current->is_array())
+            {
+                char *end = 0;
+                unsigned long index = strtoul(token.c_str(), &end, 10);
+                if(token.empty() || *end || index >= current->size())
+                    return 0;
+                current = &(*current)[index];
+            }
+            else
+                return 0;
+        }
+        return current;
+    }
+
+    bool                        hasField;
+    std::vector<std::string>    field;
+    bool                        hasGroup;
+    std::vector<std::string>    group;
+
+    Stats                       total;
+    std::map<std::string, Stats> groups;
+};
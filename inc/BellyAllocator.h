@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// -----------------------------------------------------------------------------
+// Memory for beerbelly's json values.
+//
+// Long-lived values come from a SlabHeap per thread, so strings, member
+// vectors and arrays are recycled through size-class free lists instead of
+// going through the global heap one by one, and threads don't share a lock
+// to allocate. Values freed on another thread go back to their own heap.
+//
+// Request-scoped temporaries (parsed bodies, query results and whatever the
+// query engines build on the way) are bump-allocated from a RequestArena
+// while an ArenaScope is active on the calling thread. Freeing an arena block
+// is a no-op; the whole arena is reset once the request is done. Anything
+// that must outlive the request has to be copied while no ArenaScope is
+// active, never moved.
+// -----------------------------------------------------------------------------
+
+class QueryLimits;
+
+class RequestArena
+{
+public:
+    // Header kind of arena blocks, distinct from the SlabHeap kinds.
+    static const uint32_t ARENA_BLOCK = 3;
+
+    explicit RequestArena(size_t chunkSize = 64 * 1024);
+    ~RequestArena();
+
+    RequestArena(const RequestArena &) = delete;
+    RequestArena &operator=(const RequestArena &) = delete;
+
+    void *Allocate(size_t size);
+
+    // Spends a unit of 'limits' on every allocation until reset to null, so
+    // a query building values in this arena can be stopped at its next
+    // check (see QueryLimits.h). Allocating never throws QueryAborted.
+    void SetLimits(QueryLimits *limits) { this->limits = limits; }
+
+    // Releases everything but the first chunk, which is kept for reuse.
+    void Reset();
+
+private:
+    struct Chunk
+    {
+        Chunk *next;
+        size_t capacity;
+        size_t used;
+    };
+
+    Chunk *NewChunk(size_t capacity);
+
+    size_t chunkSize;
+    Chunk *chunks;
+    QueryLimits *limits;
+};
+
+// -----------------------------------------------------------------------------
+
+// Routes BellyAllocator allocations on this thread to 'arena' until the scope
+// ends. A null arena suspends an enclosing scope.
+
+class ArenaScope
+{
+public:
+    explicit ArenaScope(RequestArena *arena);
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    RequestArena *previous;
+};
+
+// -----------------------------------------------------------------------------
+
+void *BellyAllocate(size_t size);
+void  BellyDeallocate(void *ptr);
+
+// -----------------------------------------------------------------------------
+
+// Stateless standard allocator over BellyAllocate/BellyDeallocate.
+
+template <class T>
+class BellyAllocator
+{
+public:
+    typedef T value_type;
+
+    BellyAllocator() noexcept {}
+
+    template <class U>
+    BellyAllocator(const BellyAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T*>(BellyAllocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *ptr, size_t) noexcept
+    {
+        BellyDeallocate(ptr);
+    }
+
+    template <class U>
+    struct rebind
+    {
+        typedef BellyAllocator<U> other;
+    };
+};
+
+template <class T, class U>
+bool operator==(const BellyAllocator<T> &, const BellyAllocator<U> &) noexcept { return true; }
+
+template <class T, class U>
+bool operator!=(const BellyAllocator<T> &, const BellyAllocator<U> &) noexcept { return false; }
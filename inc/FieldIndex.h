@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <jsoncons_ext/jsonpointer/jsonpointer.hpp>
+
+// -----------------------------------------------------------------------------
+// Secondary indexes on a field of the elements of an array.
+//
+// A FieldIndex maps the value found at 'keyPointer' inside each element of the
+// array at 'container' to the positions of the elements holding it. Only
+// scalar keys are indexed; elements where the key is missing or is an object
+// or array are left out, exactly as an equality filter would skip them.
+// Keys are ordered null < false < true < numbers < strings, numbers by their
+// exact value so 5 and 5.0 are the same key but 2^53 and 2^53 + 1 are not.
+//
+// Writes report the element positions they touch through Set(), Insert() and
+// Remove(). Anything the index can't follow cheaply marks it dirty, and it is
+// rebuilt from the array on the next lookup.
+// -----------------------------------------------------------------------------
+
+struct IndexKey
+{
+    int         rank;
+    bool        integral;       // an integer, held exactly as 'negative' and 'magnitude'
+    bool        negative;
+    uint64_t    magnitude;      // also 0 and 1 for false and true
+    double      number;         // numbers that aren't integers or are out of range
+    std::string text;
+
+    bool operator<(const IndexKey &rhs) const
+    {
+        if(rank != rhs.rank)
+            return rank < rhs.rank;
+        if(rank == 2)
+            return CompareNumbers(*this, rhs) < 0;
+        if(magnitude != rhs.magnitude)
+            return magnitude < rhs.magnitude;
+        return text < rhs.text;
+    }
+
+    bool operator==(const IndexKey &rhs) const
+    {
+        if(rank != rhs.rank)
+            return false;
+        if(rank == 2)
+            return CompareNumbers(*this, rhs) == 0;
+        return magnitude == rhs.magnitude && text == rhs.text;
+    }
+
+    // Whether equality of keys is exactly jsoncons' equality of the values.
+    // jsoncons compares an integer and a double as doubles, so integers
+    // from 2^53 on, where doubles skip integers, equal doubles they aren't
+    // equal to as keys. Lookups with such a key must scan instead.
+    bool Exact() const
+    {
+        static const double LIMIT = 9007199254740992.0;   // 2^53
+        if(rank != 2)
+            return true;
+        return integral ? magnitude < (uint64_t(1) << 53) : (number > -LIMIT && number < LIMIT);
+    }
+
+private:
+    static int CompareIntegers(bool aNegative, uint64_t a, bool bNegative, uint64_t b)
+    {
+        if(aNegative != bNegative)
+            return aNegative ? -1 : 1;
+        if(a == b)
+            return 0;
+        return (a < b) != aNegative ? -1 : 1;
+    }
+
+    // Numbers by value, exactly. A double that isn't held as an integer
+    // either has a fraction, and is then below 2^52 and between its floor
+    // and the next integer, or is beyond the range of integers.
+    static int CompareNumbers(const IndexKey &a, const IndexKey &b)
+    {
+        if(a.integral && b.integral)
+            return CompareIntegers(a.negative, a.magnitude, b.negative, b.magnitude);
+        if(!a.integral && !b.integral)
+            return a.number < b.number ? -1 : (b.number < a.number ? 1 : 0);
+        if(!a.integral)
+            return -CompareNumbers(b, a);
+
+        if(!(b.number > -9223372036854775808.0 && b.number < 18446744073709551616.0))
+            return b.number > 0 ? -1 : 1;
+        double floor = std::floor(b.number);
+        bool floorNegative = floor < 0;
+        uint64_t floorMagnitude = floorNegative ? uint64_t(-floor) : uint64_t(floor);
+        return CompareIntegers(a.negative, a.magnitude, floorNegative, floorMagnitude) <= 0 ? -1 : 1;
+    }
+};
+
+// -----------------------------------------------------------------------------
+
+template <class Json>
+bool MakeIndexKey(const Json &value, IndexKey &key)
+{
+    key.integral  = true;
+    key.negative  = false;
+    key.magnitude = 0;
+    key.number    = 0;
+    key.text.clear();
+    if(value.is_null())
+        key.rank = 0;
+    else if(value.is_bool())
+    {
+        key.rank      = 1;
+        key.magnitude = value.template as<bool>() ? 1 : 0;
+    }
+    else if(value.is_number())
+    {
+        key.rank = 2;
+        if(value.is_int64())
+        {
+            int64_t integer = value.template as<int64_t>();
+            key.negative  = integer < 0;
+            key.magnitude = key.negative ? uint64_t(0) - uint64_t(integer) : uint64_t(integer);
+        }
+        else if(value.is_uint64())
+            key.magnitude = value.template as<uint64_t>();
+        else
+        {
+            // Doubles with an integer value are the integer, so 5 and 5.0
+            // are the same key.
+            double number = value.template as<double>();
+            if(number == std::floor(number) && number >= -9223372036854775808.0 && number < 18446744073709551616.0)
+            {
+                key.negative  = number < 0;
+                key.magnitude = key.negative ? uint64_t(-number) : uint64_t(number);
+            }
+            else
+            {
+                key.integral = false;
+                key.number   = number;
+            }
+        }
+    }
+    else if(value.is_string())
+    {
+        key.rank = 3;
+        key.text = value.template as<std::string>();
+    }
+    else
+        return false;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// The key of one array element, false if it has none that can be indexed.
+
+template <class Json>
+bool ElementKey(const Json &element, const std::string &keyPointer, IndexKey &key)
+{
+    std::error_code ec;
+    const Json &value = jsoncons::jsonpointer::get(element, keyPointer, ec);
+    return !ec && MakeIndexKey(value, key);
+}
+
+// -----------------------------------------------------------------------------
+
+template <class Json>
+class FieldIndex
+{
+public:
+    typedef std::map<IndexKey, std::vector<size_t>> Entries;
+
+    FieldIndex(const std::vector<std::string> &container, const std::string &keyPointer) :
+        container(container), keyPointer(keyPointer), dirty(true) {}
+
+    const std::vector<std::string> &Container() const { return container; }
+    const std::string &KeyPointer() const { return keyPointer; }
+
+    void Invalidate() { dirty = true; }
+
+    // -------------------------------------------------------------------------
+
+    // Positions, ascending, of the elements of 'array' whose key equals 'key'.
+    // 'array' must be the current value at Container().
+    const std::vector<size_t> &Find(const Json &array, const IndexKey &key)
+    {
+        static const std::vector<size_t> none;
+        Refresh(array);
+        auto entry = entries.find(key);
+        return entry == entries.end() ? none : entry->second;
+    }
+
+    // All entries in key order, for range scans and ordered reads.
+    const Entries &All(const Json &array)
+    {
+        Refresh(array);
+        return entries;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // The element at 'position' of 'array' was appended, replaced or changed.
+    void Set(const Json &array, size_t position)
+    {
+        if(dirty || position > keys.size() || position >= array.size())
+        {
+            dirty = true;
+            return;
+        }
+
+        if(position < keys.size())
+            Drop(position);
+        else
+        {
+            keys.emplace_back();
+            indexed.push_back(false);
+        }
+
+        indexed[position] = ElementKey(array[position], keyPointer, keys[position]);
+        if(indexed[position])
+        {
+            std::vector<size_t> &positions = entries[keys[position]];
+            positions.insert(std::lower_bound(positions.begin(), positions.end(), position), position);
+        }
+    }
+
+    // An element was inserted at 'position'. Only appends are followed;
+    // anything else shifts every later position.
+    void Insert(const Json &array, size_t position)
+    {
+        if(position != keys.size())
+            dirty = true;
+        else
+            Set(array, position);
+    }
+
+    // The element at 'position' was removed. Only removing the last element
+    // is followed.
+    void Remove(size_t position)
+    {
+        if(dirty || position + 1 != keys.size())
+        {
+            dirty = true;
+            return;
+        }
+        Drop(position);
+        keys.pop_back();
+        indexed.pop_back();
+    }
+
+private:
+    void Drop(size_t position)
+    {
+        if(!indexed[position])
+            return;
+        auto entry = entries.find(keys[position]);
+        std::vector<size_t> &positions = entry->second;
+        positions.erase(std::lower_bound(positions.begin(), positions.end(), position));
+        if(positions.empty())
+            entries.erase(entry);
+        indexed[position] = false;
+    }
+
+    void Refresh(const Json &array)
+    {
+        if(!dirty && keys.size() == array.size())
+            return;
+
+        entries.clear();
+        keys.assign(array.size(), IndexKey());
+        indexed.assign(array.size(), false);
+        for(size_t position = 0; position < array.size(); ++position)
+        {
+            indexed[position] = ElementKey(array[position], keyPointer, keys[position]);
+            if(indexed[position])
+                entries[keys[position]].push_back(position);
+        }
+        dirty = false;
+    }
+
+    std::vector<std::string> container;
+    std::string              keyPointer;
+
+    Entries                  entries;
+    std::vector<IndexKey>    keys;
+    std::vector<bool>        indexed;
+    bool                     dirty;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// -----------------------------------------------------------------------------
+// A bounded map that evicts the least recently used entry. References handed
+// out stay valid until that entry is evicted or erased. Not thread safe.
+// -----------------------------------------------------------------------------
+
+template <class Key, class Value>
+class LruCache
+{
+public:
+    explicit LruCache(size_t capacity = 1024) : capacity(capacity), hits(0), misses(0) {}
+
+    void SetCapacity(size_t count)
+    {
+        capacity = count;
+        while(items.size() > capacity)
+            EvictOne();
+    }
+
+    // Returns the cached value and marks it most recently used, or null.
+    Value *Find(const Key &key)
+    {
+        auto entry = lookup.find(key);
+        if(entry == lookup.end())
+        {
+            ++misses;
+            return 0;
+        }
+        ++hits;
+        items.splice(items.begin(), items, entry->second);
+        return &entry->second->second;
+    }
+
+    // Inserts or replaces the value for 'key'. With a capacity of zero the
+    // value is still returned but not kept past the next insert.
+    Value &Insert(const Key &key, Value value)
+    {
+        auto entry = lookup.find(key);
+        if(entry != lookup.end())
+        {
+            entry->second->second = std::move(value);
+            items.splice(items.begin(), items, entry->second);
+            return entry->second->second;
+        }
+
+        while(!items.empty() && items.size() >= capacity)
+            EvictOne();
+
+        items.emplace_front(key, std::move(value));
+        lookup[key] = items.begin();
+        return items.front().second;
+    }
+
+    void Erase(const Key &key)
+    {
+        auto entry = lookup.find(key);
+        if(entry == lookup.end())
+            return;
+        items.erase(entry->second);
+        lookup.erase(entry);
+    }
+
+    void Clear()
+    {
+        items.clear();
+        lookup.clear();
+    }
+
+    // Calls f(key, value) for every entry, most recently used first.
+    template <class F>
+    void ForEach(F f)
+    {
+        for(auto &item : items)
+            f(item.first, item.second);
+    }
+
+    // Erases every entry for which pred(key, value) is true.
+    template <class Pred>
+    void EraseIf(Pred pred)
+    {
+        for(auto item = items.begin(); item != items.end(); )
+        {
+            if(pred(item->first, item->second))
+            {
+                lookup.erase(item->first);
+                item = items.erase(item);
+            }
+            else
+                ++item;
+        }
+    }
+
+    size_t Size() const     { return items.size(); }
+    size_t Capacity() const { return capacity; }
+    size_t Hits() const     { return hits; }
+    size_t Misses() const   { return misses; }
+
+private:
+    void EvictOne()
+    {
+        lookup.erase(items.back().first);
+        items.pop_back();
+    }
+
+    typedef std::list<std::pair<Key, Value>> List;
+
+    List items;
+    std::unordered_map<Key, typename List::iterator> lookup;
+    size_t capacity;
+    size_t hits;
+    size_t misses;
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <string_view>
+#include <unordered_map>
+
+#include "rapidjson/document.h"
+
+// -----------------------------------------------------------------------------
+// Side hash indexes for large RapidJSON objects.
+//
+// FindMember is a linear scan. Objects with at least 'threshold' members get a
+// hash table from member name to member position, built on first lookup and
+// kept in sync by the AddMember, RemoveMember and EraseMember wrappers below.
+// Tables are keyed by the object's member array, which stays put when the
+// object value itself is moved or swapped around; a table whose member count
+// no longer matches is rebuilt. Values that are about to be destroyed must be
+// passed to Forget() so their tables don't outlive them. As a freed member
+// array may come back for another object, a hit is checked against the
+// member's name, and a table that doesn't match is rebuilt.
+//
+// A threshold of zero disables indexing; every lookup is then a plain scan.
+// -----------------------------------------------------------------------------
+
+template <class ValueType>
+class ObjectIndex
+{
+public:
+    typedef typename ValueType::Ch                 Ch;
+    typedef typename ValueType::Member             Member;
+    typedef typename ValueType::MemberIterator     MemberIterator;
+    typedef typename ValueType::AllocatorType      Allocator;
+
+    ObjectIndex() : threshold(0) {}
+
+    void SetThreshold(rapidjson::SizeType count)
+    {
+        threshold = count;
+        tables.clear();
+    }
+
+    bool Empty() const { return tables.empty(); }
+    size_t Size() const { return tables.size(); }
+
+    // Drops every table; they are rebuilt lazily.
+    void Clear() { tables.clear(); }
+
+    // -------------------------------------------------------------------------
+
+    MemberIterator FindMember(ValueType &object, const Ch *name, rapidjson::SizeType length)
+    {
+        Table *table = Lookup(object);
+        if(!table)
+        {
+            ValueType key(rapidjson::StringRef(name, length));
+            return object.FindMember(key);
+        }
+
+        std::basic_string_view<Ch> key(name, length);
+        auto entry = table->positions.find(key);
+        if(entry == table->positions.end())
+            return object.MemberEnd();
+
+        MemberIterator m = object.MemberBegin() + entry->second;
+        if(View(m->name) == key)
+            return m;
+
+        // A stale table for a reused member array; start over.
+        table->positions.clear();
+        return FindMember(object, name, length);
+    }
+
+    MemberIterator FindMember(ValueType &object, const ValueType &name)
+    {
+        return FindMember(object, name.GetString(), name.GetStringLength());
+    }
+
+    // -------------------------------------------------------------------------
+
+    void AddMember(ValueType &object, ValueType &name, ValueType &value, Allocator &allocator)
+    {
+        auto t = tables.find(MembersOf(object));
+        const Member *before = MembersOf(object);
+
+        object.AddMember(name, value, allocator);
+
+        if(t == tables.end())
+            return;
+
+        // A reallocated member array invalidates the keys, which may point
+        // into short strings stored inline in the members.
+        if(before != MembersOf(object) || t->second.count + 1 != object.MemberCount())
+        {
+            tables.erase(t);
+            return;
+        }
+
+        MemberIterator added = object.MemberEnd() - 1;
+        t->second.positions.emplace(View(added->name), object.MemberCount() - 1);
+        t->second.count = object.MemberCount();
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Like ValueType::RemoveMember, moves the last member into the hole.
+    MemberIterator RemoveMember(ValueType &object, MemberIterator m)
+    {
+        // Tables of objects with duplicate names only hold the first of
+        // each and can't be patched up; drop those too.
+        auto t = tables.find(MembersOf(object));
+        if(t == tables.end() || t->second.count != object.MemberCount() 
+                             || t->second.positions.size() != t->second.count)
+        {
+            if(t != tables.end())
+                tables.erase(t);
+            return object.RemoveMember(m);
+        }
+
+        Table &table = t->second;
+        rapidjson::SizeType position = static_cast<rapidjson::SizeType>(m - object.MemberBegin());
+        rapidjson::SizeType last = object.MemberCount() - 1;
+
+        EraseKey(table, m->name, position);
+        if(position != last)
+            EraseKey(table, object.MemberBegin()[last].name, last);
+
+        MemberIterator result = object.RemoveMember(m);
+
+        if(position != last)
+            table.positions.emplace(View(object.MemberBegin()[position].name), position);
+        table.count = object.MemberCount();
+        return result;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Like ValueType::EraseMember, keeps the order of the members, shifting
+    // the ones after 'm' down; their entries move along.
+    MemberIterator EraseMember(ValueType &object, MemberIterator m)
+    {
+        auto t = tables.find(MembersOf(object));
+        if(t == tables.end() || t->second.count != object.MemberCount() 
+                             || t->second.positions.size() != t->second.count)
+        {
+            if(t != tables.end())
+                tables.erase(t);
+            return object.EraseMember(m);
+        }
+
+        // The keys may point into short strings stored inline in the
+        // members, so those of the shifted members go before they move.
+        Table &table = t->second;
+        rapidjson::SizeType position = static_cast<rapidjson::SizeType>(m - object.MemberBegin());
+        for(rapidjson::SizeType i = position; i < object.MemberCount(); ++i)
+            EraseKey(table, object.MemberBegin()[i].name, i);
+
+        MemberIterator result = object.EraseMember(m);
+
+        for(rapidjson::SizeType i = position; i < object.MemberCount(); ++i)
+            table.positions.emplace(View(object.MemberBegin()[i].name), i);
+        table.count = object.MemberCount();
+        return result;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Drops the table of 'object' alone, e.g. after its members were
+    // reordered in place.
+    void Reordered(const ValueType &object)
+    {
+        if(object.IsObject() && object.MemberCount())
+            tables.erase(MembersOf(object));
+    }
+
+    // -------------------------------------------------------------------------
+
+    void Forget(const ValueType &value)
+    {
+        if(tables.empty())
+            return;
+
+        if(value.IsObject())
+        {
+            if(value.MemberCount())
+                tables.erase(MembersOf(value));
+            for(auto m = value.MemberBegin(); m != value.MemberEnd(); ++m)
+                Forget(m->value);
+        }
+        else if(value.IsArray())
+        {
+            for(auto e = value.Begin(); e != value.End(); ++e)
+                Forget(*e);
+        }
+    }
+
+private:
+    struct Table
+    {
+        std::unordered_map<std::basic_string_view<Ch>, rapidjson::SizeType> positions;
+        rapidjson::SizeType count = 0;
+    };
+
+    static const Member *MembersOf(const ValueType &object)
+    {
+        return object.MemberBegin().operator->();
+    }
+
+    static std::basic_string_view<Ch> View(const ValueType &name)
+    {
+        return std::basic_string_view<Ch>(name.GetString(), name.GetStringLength());
+    }
+
+    static void EraseKey(Table &table, const ValueType &name, rapidjson::SizeType position)
+    {
+        auto entry = table.positions.find(View(name));
+        if(entry != table.positions.end() && entry->second == position)
+            table.positions.erase(entry);
+    }
+
+    Table *Lookup(ValueType &object)
+    {
+        if(!threshold || object.MemberCount() < threshold)
+            return 0;
+
+        Table &table = tables[MembersOf(object)];
+        if(table.count != object.MemberCount() || table.positions.empty())
+        {
+            table.positions.clear();
+            table.positions.reserve(object.MemberCount());
+
+            // Only the first of duplicate names is indexed, as FindMember
+            // returns that one.
+            rapidjson::SizeType position = 0;
+            for(auto m = object.MemberBegin(); m != object.MemberEnd(); ++m, ++position)
+                table.positions.emplace(View(m->name), position);
+            table.count = object.MemberCount();
+        }
+        return &table;
+    }
+
+    std::unordered_map<const Member*, Table> tables;
+    rapidjson::SizeType threshold;
+};
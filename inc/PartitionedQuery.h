@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <jsoncons/json.hpp>
+
+#include "WorkerPool.h"
+
+// -----------------------------------------------------------------------------
+// Partitioned evaluation of element-wise queries: a query whose result over
+// an array is the concatenation of its results over the elements can be run
+// on slices of the array, in parallel, and the partial results joined in
+// order give exactly the result over the whole array.
+// -----------------------------------------------------------------------------
+
+// Whether a JMESPath expression has an operator outside brackets, braces,
+// parentheses and literals: a pipe, "||", "&&", a comparison or "!". Each of
+// them applies to the whole projection, not to the elements one by one.
+
+inline bool HasTopLevelOperator(const std::string &query)
+{
+    static const std::string operators = "|&<>=!";
+
+    int depth = 0;
+    for(size_t i = 0; i < query.size(); ++i)
+    {
+        char c = query[i];
+        if(c == '\'' || c == '"' || c == '`')
+        {
+            // Raw strings, quoted names and JSON literals end at the next
+            // unescaped quote of the same kind.
+            for(++i; i < query.size() && query[i] != c; ++i)
+            {
+                if(query[i] == '\\')
+                    ++i;
+            }
+        }
+        else if(c == '[' || c == '(' || c == '{')
+            ++depth;
+        else if(c == ']' || c == ')' || c == '}')
+            --depth;
+        else if(depth == 0 && operators.find(c) != std::string::npos)
+            return true;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+
+// Recognizes queries whose result over an array is the concatenation of their
+// results over its elements: JSONPath starting with "[?", "[*]" or ".*", after
+// an optional chain of member names leading to the array, and JMESPath
+// starting with "[?" or "[*]" without flattening or top-level operators.
+// 'prefix' gets the member names and 'elementwise' the query to run on the
+// array itself. JSONPath filters referring to the root ('$') don't qualify.
+
+inline bool SplitElementwiseQuery(const std::string &query, std::vector<std::string> &prefix, std::string &elementwise)
+{
+    auto startsElementwise = [](const std::string &text)
+    {
+        return text.compare(0, 2, "[?") == 0 || text.compare(0, 3, "[*]") == 0;
+    };
+
+    prefix.clear();
+    if(query.compare(0, 1, "$") != 0)
+    {
+        if(!startsElementwise(query) || HasTopLevelOperator(query)
+                                     || query.find("[]") != std::string::npos)
+            return false;
+        elementwise = query;
+        return true;
+    }
+
+    static const std::regex step(R"(^(?:\.([A-Za-z_][A-Za-z0-9_]*)|\['([^'\\]*)'\]))");
+
+    std::string rest = query.substr(1);
+    std::smatch match;
+    while(!startsElementwise(rest) && rest.compare(0, 2, ".*") != 0 && std::regex_search(rest, match, step))
+    {
+        prefix.push_back(match[1].matched ? match[1].str() : match[2].str());
+        rest = match.suffix().str();
+    }
+
+    if((!startsElementwise(rest) && rest.compare(0, 2, ".*") != 0) || rest.find('$') != std::string::npos)
+        return false;
+    elementwise = "$" + rest;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// An array of pointers to elements 'begin' to 'end' of 'array', standing in
+// for a slice of it without copying the elements.
+
+template <class Json>
+Json SliceOf(const Json &array, size_t begin, size_t end)
+{
+    Json slice(jsoncons::json_array_arg);
+    slice.reserve(end - begin);
+    for(size_t i = begin; i < end; ++i)
+        slice.emplace_back(jsoncons::json_const_pointer_arg, &array[i]);
+    return slice;
+}
+
+// -----------------------------------------------------------------------------
+
+// Splits 'array' into 'parts' runs of elements and calls evaluate(begin, end,
+// slot) for each, on 'pool' when it isn't null and one after the other
+// otherwise, then moves the partial results, in order, into 'result'. 'slot'
+// is the WorkerPool slot running the part, 0 without a pool. Returns false,
+// leaving 'result' alone, when a partial result isn't an array.
+
+template <class Json, class Evaluate>
+bool EvaluateInParts(const Json &array, size_t parts, WorkerPool *pool, const Evaluate &evaluate, Json &result)
+{
+    std::vector<Json> partials(parts);
+    WorkerPool::Task task = [&](size_t part, size_t slot)
+    {
+        partials[part] = evaluate(array.size() * part / parts, array.size() * (part + 1) / parts, slot);
+    };
+
+    if(pool)
+        pool->Run(parts, task);
+    else
+        for(size_t part = 0; part < parts; ++part)
+            task(part, 0);
+
+    size_t total = 0;
+    for(const Json &partial : partials)
+    {
+        if(!partial.is_array())
+            return false;
+        total += partial.size();
+    }
+
+    Json joined(jsoncons::json_array_arg);
+    joined.reserve(total);
+    for(Json &partial : partials)
+        for(Json &value : partial.array_range())
+            joined.push_back(std::move(value));
+    result = std::move(joined);
+    return true;
+}
@@ -0,0 +1,536 @@
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "rapidjson/document.h"
+
+// -----------------------------------------------------------------------------
+// A JSONPath subset evaluated straight over RapidJSON values.
+//
+// Supported are the root '$', member names as '.name' or ['name'], indexes
+// [n] (negative from the end), wildcards '.*' and [*], slices [start:end:step]
+// and filters comparing a member path of the current node ('@', '@.a.b' or
+// "@['a']") with a literal:
+//
+//     $.orders[?(@.Quantity >= 5)].Customer
+//     $[-10:]
+//     $.items[?(@.state == 'open')]
+//
+// A filter without operator, [?(@.a)], tests for the member. Comparisons are
+// between numbers or between strings; other types only compare equal to
+// themselves with == and !=.
+//
+// A query is compiled once into a plan of steps. Evaluate() walks the plan
+// depth first and hands every match to a visitor, in document order, without
+// building a result.
+// -----------------------------------------------------------------------------
+
+template <class ValueType>
+class PathQuery
+{
+public:
+    typedef typename ValueType::Ch Ch;
+
+    // Compiles 'query'. On failure returns false with a message in 'error',
+    // and the query is left empty.
+    bool Compile(const std::string &query, std::string &error)
+    {
+        steps.clear();
+        text = query;
+        pos  = 0;
+        SkipSpace();
+        if(!Eat('$'))
+            return Fail("query must start with '$'", error);
+
+        for(;;)
+        {
+            SkipSpace();
+            if(pos == text.size())
+            {
+                text.clear();
+                return true;
+            }
+
+            Step step;
+            if(Eat('.'))
+            {
+                if(Peek('.'))
+                    return Fail("recursive descent is not supported", error);
+                if(Eat('*'))
+                    step.kind = WILDCARD;
+                else if(!ParseName(step.name))
+                    return Fail("member name expected", error);
+                else
+                    step.kind = CHILD;
+            }
+            else if(Eat('['))
+            {
+                SkipSpace();
+                if(!ParseBracket(step, error))
+                    return false;
+                SkipSpace();
+                if(!Eat(']'))
+                    return Fail("']' expected", error);
+            }
+            else
+                return Fail("'.' or '[' expected", error);
+
+            steps.push_back(step);
+        }
+    }
+
+    bool Empty() const { return steps.empty(); }
+
+    // Calls visit(value) for every match of the query against 'root'.
+    template <class Visit>
+    void Evaluate(ValueType &root, Visit visit) const
+    {
+        Evaluate(root, visit, [](ValueType &object, const std::string &name) -> ValueType *
+        {
+            ValueType key(rapidjson::StringRef(name.c_str(), (rapidjson::SizeType)name.size()));
+            auto m = object.FindMember(key);
+            return m == object.MemberEnd() ? 0 : &m->value;
+        });
+    }
+
+    // As above, looking members up with find(object, name), which returns
+    // the member's value or null.
+    template <class Visit, class Find>
+    void Evaluate(ValueType &root, Visit visit, Find find) const
+    {
+        Evaluate(root, visit, find, [](ValueType &array, rapidjson::SizeType i) -> ValueType &
+        {
+            return array[i];
+        });
+    }
+
+    // As above, taking element 'i' of an array as element(array, i), for
+    // arrays whose elements aren't stored in order.
+    template <class Visit, class Find, class Element>
+    void Evaluate(ValueType &root, Visit visit, Find find, Element element) const
+    {
+        Walk(root, 0, visit, find, element);
+    }
+
+private:
+    enum Kind
+    {
+        CHILD,
+        INDEX,
+        WILDCARD,
+        SLICE,
+        FILTER
+    };
+
+    enum Op
+    {
+        EXISTS,
+        EQ,
+        NE,
+        LT,
+        LE,
+        GT,
+        GE
+    };
+
+    enum LiteralType
+    {
+        LITERAL_NULL,
+        LITERAL_BOOL,
+        LITERAL_NUMBER,
+        LITERAL_STRING
+    };
+
+    struct Step
+    {
+        Kind        kind = CHILD;
+        std::string name;                   // CHILD
+        long        index = 0;              // INDEX
+        long        start = 0, end = 0, step = 1;
+        bool        hasStart = false, hasEnd = false;
+
+        // FILTER: @ followed by 'path', compared by 'op' with the literal.
+        std::vector<std::string> path;
+        Op          op = EXISTS;
+        LiteralType type = LITERAL_NULL;
+        bool        boolean = false;
+        double      number = 0;
+        std::string string;
+    };
+
+    // -------------------------------------------------------------------------
+
+    template <class Visit, class Find, class Element>
+    void Walk(ValueType &node, size_t s, Visit &visit, Find &find, Element &element) const
+    {
+        if(s == steps.size())
+        {
+            visit(node);
+            return;
+        }
+
+        const Step &step = steps[s];
+        switch(step.kind)
+        {
+            case CHILD:
+                if(node.IsObject())
+                {
+                    ValueType *child = find(node, step.name);
+                    if(child)
+                        Walk(*child, s + 1, visit, find, element);
+                }
+                break;
+
+            case INDEX:
+                if(node.IsArray())
+                {
+                    long size = (long)node.Size();
+                    long i = step.index < 0 ? size + step.index : step.index;
+                    if(i >= 0 && i < size)
+                        Walk(element(node, (rapidjson::SizeType)i), s + 1, visit, find, element);
+                }
+                break;
+
+            case WILDCARD:
+                if(node.IsArray())
+                    for(rapidjson::SizeType i = 0; i < node.Size(); ++i)
+                        Walk(element(node, i), s + 1, visit, find, element);
+                else if(node.IsObject())
+                    for(auto &member : node.GetObject())
+                        Walk(member.value, s + 1, visit, find, element);
+                break;
+
+            case SLICE:
+                if(node.IsArray())
+                {
+                    long size = (long)node.Size();
+                    long start, end;
+                    SliceBounds(step, size, start, end);
+
+                    // A step longer than the array goes no further than one
+                    // of its size, which keeps 'i' from overflowing.
+                    long stride = step.step > size ? size : (step.step < -size ? -size : step.step);
+                    if(stride > 0)
+                        for(long i = start; i < end; i += stride)
+                            Walk(element(node, (rapidjson::SizeType)i), s + 1, visit, find, element);
+                    else if(stride < 0)
+                        for(long i = start; i > end; i += stride)
+                            Walk(element(node, (rapidjson::SizeType)i), s + 1, visit, find, element);
+                }
+                break;
+
+            case FILTER:
+                if(node.IsArray())
+                {
+                    for(rapidjson::SizeType i = 0; i < node.Size(); ++i)
+                    {
+                        ValueType &candidate = element(node, i);
+                        if(Test(step, candidate, find))
+                            Walk(candidate, s + 1, visit, find, element);
+                    }
+                }
+                else if(node.IsObject())
+                {
+                    for(auto &member : node.GetObject())
+                        if(Test(step, member.value, find))
+                            Walk(member.value, s + 1, visit, find, element);
+                }
+                break;
+        }
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Python slice semantics: bounds are clamped and negative ones count from
+    // the end; with a negative step the defaults run from the last element
+    // down to before the first.
+    static void SliceBounds(const Step &step, long size, long &start, long &end)
+    {
+        auto clamp = [size](long i, long low, long high)
+        {
+            if(i < 0)
+                i += size;
+            return i < low ? low : (i > high ? high : i);
+        };
+
+        if(step.step > 0)
+        {
+            start = step.hasStart ? clamp(step.start, 0, size) : 0;
+            end   = step.hasEnd   ? clamp(step.end, 0, size)   : size;
+        }
+        else
+        {
+            start = step.hasStart ? clamp(step.start, -1, size - 1) : size - 1;
+            end   = step.hasEnd   ? clamp(step.end, -1, size - 1)   : -1;
+        }
+    }
+
+    // -------------------------------------------------------------------------
+
+    template <class Find>
+    static bool Test(const Step &step, ValueType &candidate, Find &find)
+    {
+        ValueType *value = &candidate;
+        for(const std::string &name : step.path)
+        {
+            if(!value->IsObject() || !(value = find(*value, name)))
+                return false;
+        }
+
+        if(step.op == EXISTS)
+            return true;
+
+        int order;
+        if(step.type == LITERAL_NUMBER && value->IsNumber())
+        {
+            double number = value->GetDouble();
+            order = number < step.number ? -1 : (number > step.number ? 1 : 0);
+        }
+        else if(step.type == LITERAL_STRING && value->IsString())
+        {
+            int c = step.string.compare(0, std::string::npos, value->GetString(), value->GetStringLength());
+            order = c > 0 ? -1 : (c < 0 ? 1 : 0);
+        }
+        else
+        {
+            bool same = (step.type == LITERAL_NULL && value->IsNull()) ||
+                        (step.type == LITERAL_BOOL && value->IsBool() && value->GetBool() == step.boolean);
+            return step.op == EQ ? same : (step.op == NE ? !same : false);
+        }
+
+        switch(step.op)
+        {
+            case EQ: return order == 0;
+            case NE: return order != 0;
+            case LT: return order <  0;
+            case LE: return order <= 0;
+            case GT: return order >  0;
+            case GE: return order >= 0;
+            default: return false;
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    // Parsing.
+
+    bool ParseBracket(Step &step, std::string &error)
+    {
+        if(Eat('*'))
+        {
+            step.kind = WILDCARD;
+            return true;
+        }
+        if(Peek('\'') || Peek('"'))
+        {
+            step.kind = CHILD;
+            if(!ParseQuoted(step.name))
+                return Fail("unterminated string", error);
+            return true;
+        }
+        if(Eat('?'))
+        {
+            step.kind = FILTER;
+            return ParseFilter(step, error);
+        }
+
+        // An index or a slice.
+        long numbers[3] = { 0, 0, 1 };
+        bool present[3] = { false, false, false };
+        int colons = 0;
+        for(int part = 0; part < 3; ++part)
+        {
+            SkipSpace();
+            present[part] = ParseInteger(numbers[part]);
+            SkipSpace();
+            if(part == 2 || !Eat(':'))
+                break;
+            ++colons;
+        }
+
+        if(colons == 0)
+        {
+            if(!present[0])
+                return Fail("index, name, '*' or filter expected", error);
+            step.kind  = INDEX;
+            step.index = numbers[0];
+            return true;
+        }
+
+        step.kind     = SLICE;
+        step.start    = numbers[0];
+        step.hasStart = present[0];
+        step.end      = numbers[1];
+        step.hasEnd   = present[1];
+        step.step     = present[2] ? numbers[2] : 1;
+        if(step.step == 0)
+            return Fail("slice step must not be zero", error);
+        return true;
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool ParseFilter(Step &step, std::string &error)
+    {
+        SkipSpace();
+        if(!Eat('('))
+            return Fail("'(' expected after '?'", error);
+        SkipSpace();
+        if(!Eat('@'))
+            return Fail("filter must start with '@'", error);
+
+        for(;;)
+        {
+            std::string name;
+            if(Eat('.'))
+            {
+                if(!ParseName(name))
+                    return Fail("member name expected", error);
+            }
+            else if(Peek('[') && pos + 1 < text.size() && (text[pos + 1] == '\'' || text[pos + 1] == '"'))
+            {
+                ++pos;
+                if(!ParseQuoted(name) || !Eat(']'))
+                    return Fail("bad member name in filter", error);
+            }
+            else
+                break;
+            step.path.push_back(name);
+        }
+
+        SkipSpace();
+        static const struct { const char *token; Op op; } ops[] =
+        {
+            { "==", EQ }, { "!=", NE }, { "<=", LE }, { ">=", GE }, { "<", LT }, { ">", GT }
+        };
+        step.op = EXISTS;
+        for(const auto &o : ops)
+        {
+            if(text.compare(pos, strlen(o.token), o.token) == 0)
+            {
+                pos += strlen(o.token);
+                step.op = o.op;
+                break;
+            }
+        }
+
+        if(step.op != EXISTS)
+        {
+            SkipSpace();
+            if(!ParseLiteral(step))
+                return Fail("literal expected", error);
+        }
+
+        SkipSpace();
+        if(!Eat(')'))
+            return Fail("')' expected", error);
+        return true;
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool ParseLiteral(Step &step)
+    {
+        if(Peek('\'') || Peek('"'))
+        {
+            step.type = LITERAL_STRING;
+            return ParseQuoted(step.string);
+        }
+        if(EatWord("true"))  { step.type = LITERAL_BOOL; step.boolean = true;  return true; }
+        if(EatWord("false")) { step.type = LITERAL_BOOL; step.boolean = false; return true; }
+        if(EatWord("null"))  { step.type = LITERAL_NULL; return true; }
+
+        const char *begin = text.c_str() + pos;
+        char *end = 0;
+        errno = 0;
+        double number = strtod(begin, &end);
+        if(end == begin || errno == ERANGE)
+            return false;
+        pos += end - begin;
+        step.type   = LITERAL_NUMBER;
+        step.number = number;
+        return true;
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool ParseName(std::string &name)
+    {
+        size_t begin = pos;
+        while(pos < text.size() && (isalnum((unsigned char)text[pos]) || text[pos] == '_' || text[pos] == '-' || (unsigned char)text[pos] >= 0x80))
+            ++pos;
+        name = text.substr(begin, pos - begin);
+        return !name.empty();
+    }
+
+    // A string in single or double quotes; a backslash escapes the next char.
+    bool ParseQuoted(std::string &value)
+    {
+        char quote = text[pos++];
+        value.clear();
+        while(pos < text.size() && text[pos] != quote)
+        {
+            if(text[pos] == '\\' && pos + 1 < text.size())
+                ++pos;
+            value += text[pos++];
+        }
+        return Eat(quote);
+    }
+
+    bool ParseInteger(long &value)
+    {
+        const char *begin = text.c_str() + pos;
+        char *end = 0;
+        errno = 0;
+        long number = strtol(begin, &end, 10);
+        if(end == begin || errno == ERANGE)
+            return false;
+        pos += end - begin;
+        value = number;
+        return true;
+    }
+
+    // -------------------------------------------------------------------------
+
+    bool Peek(char c) const { return pos < text.size() && text[pos] == c; }
+
+    bool Eat(char c)
+    {
+        if(!Peek(c))
+            return false;
+        ++pos;
+        return true;
+    }
+
+    bool EatWord(const char *word)
+    {
+        size_t length = strlen(word);
+        if(text.compare(pos, length, word) != 0)
+            return false;
+        pos += length;
+        return true;
+    }
+
+    void SkipSpace()
+    {
+        while(pos < text.size() && isspace((unsigned char)text[pos]))
+            ++pos;
+    }
+
+    bool Fail(const std::string &message, std::string &error)
+    {
+        error = message + " at offset " + std::to_string(pos);
+        steps.clear();
+        return false;
+    }
+
+    std::vector<Step> steps;
+
+    // Compilation state.
+    std::string text;
+    size_t      pos = 0;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Version stamps for the subtrees of a document.
+//
+// Every write bumps a document-wide counter and records it at the written
+// path: as the "subtree" stamp of the path and of all its ancestors, whose
+// contents changed, and as the "direct" stamp of the path itself, which
+// covers everything below it. The version of a path is the newest of its own
+// subtree stamp and the direct stamps on the way down to it, so two reads of
+// a path that see the same version saw the same value.
+//
+// Stamps below a direct write are dropped, as the direct stamp supersedes
+// them. When the table grows past its limit it collapses into one direct
+// stamp at the root, which only makes every path look changed.
+//
+// Not thread safe.
+// -----------------------------------------------------------------------------
+
+class PathVersions
+{
+public:
+    typedef std::vector<std::string> Path;
+
+    explicit PathVersions(size_t limit = 64 * 1024);
+
+    // Records a write that replaced or modified the value at 'path' and
+    // returns the new document version.
+    uint64_t Touch(const Path &path);
+
+    // The version of the value at 'path'.
+    uint64_t Version(const Path &path) const;
+
+    // The latest document version.
+    uint64_t Current() const { return current; }
+
+    size_t Size() const { return stamps.size(); }
+
+private:
+    struct Stamp
+    {
+        uint64_t subtree = 0;
+        uint64_t direct  = 0;
+    };
+
+    std::map<Path, Stamp> stamps;
+    uint64_t current;
+    size_t   limit;
+};
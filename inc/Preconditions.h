@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+
+// -----------------------------------------------------------------------------
+// Conditional requests: If-Match and If-None-Match as in RFC 9110 section 13.
+//
+// The headers are lists of quoted entity tags, or "*" for any current
+// representation. If-Match compares strongly, so weak tags (W/"...") never
+// match; If-None-Match compares weakly. The ETag of a resource that doesn't
+// exist is empty, which only "*" tells apart.
+// -----------------------------------------------------------------------------
+
+enum Precondition
+{
+    PRECONDITION_HOLDS,
+    PRECONDITION_FAILED,        // answer 412 Precondition Failed
+    PRECONDITION_NOT_MODIFIED   // answer 304 Not Modified, for GET and HEAD
+};
+
+// -----------------------------------------------------------------------------
+
+// Whether the list in 'header' has 'etag', or is "*" and 'etag' is not empty.
+
+inline bool ETagListMatches(const char *header, const std::string &etag, bool weak)
+{
+    const char *c = header;
+    while(*c)
+    {
+        if(*c == ' ' || *c == '\t' || *c == ',')
+        {
+            ++c;
+            continue;
+        }
+
+        if(*c == '*')
+        {
+            if(!etag.empty())
+                return true;
+            ++c;
+            continue;
+        }
+
+        bool isWeak = c[0] == 'W' && c[1] == '/';
+        if(isWeak)
+            c += 2;
+
+        const char *start = c;
+        if(*c == '"')
+        {
+            ++c;
+            while(*c && *c != '"')
+                ++c;
+            if(*c)
+                ++c;
+        }
+        else
+        {
+            while(*c && *c != ',')
+                ++c;
+        }
+
+        if((weak || !isWeak) && !etag.empty() && etag.compare(0, std::string::npos, start, c - start) == 0)
+            return true;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+
+// Evaluates the If-Match and If-None-Match headers, either null when absent,
+// against the current 'etag' of the target. 'read' is true for GET and HEAD,
+// which answer a matching If-None-Match with 304 rather than 412.
+
+inline Precondition EvaluatePreconditions(const char *ifMatch, const char *ifNoneMatch, const std::string &etag, bool read)
+{
+    if(ifMatch && !ETagListMatches(ifMatch, etag, false))
+        return PRECONDITION_FAILED;
+    if(ifNoneMatch && ETagListMatches(ifNoneMatch, etag, true))
+        return read ? PRECONDITION_NOT_MODIFIED : PRECONDITION_FAILED;
+    return PRECONDITION_HOLDS;
+}
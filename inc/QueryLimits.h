@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+// -----------------------------------------------------------------------------
+// Per-query limits: a wall-clock deadline and a budget of work units. Work is
+// recorded from wherever evaluation can be observed (values built in the
+// request arenas, elements handed to a partition), and the query is aborted
+// by throwing QueryAborted, but only from points where unwinding is safe:
+// between the slices of a split query and between result elements. Inside
+// the query engines, where an allocation can't throw anything but
+// bad_alloc, going over is only noted with Spend() and turns into an abort
+// at the next Check() or Charge(). Aborting is therefore best effort: one
+// evaluation step, like a whole unsplit query, runs to its end past the
+// limits. All members may be called from several threads at once.
+// -----------------------------------------------------------------------------
+
+class QueryAborted : public std::runtime_error
+{
+public:
+    enum Reason
+    {
+        DEADLINE,
+        BUDGET
+    };
+
+    explicit QueryAborted(Reason reason) :
+        std::runtime_error(reason == DEADLINE ? "query deadline exceeded" : "query budget exceeded"),
+        reason(reason) {}
+
+    const Reason reason;
+};
+
+// -----------------------------------------------------------------------------
+
+class QueryLimits
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Zero for either limit means none.
+    QueryLimits(std::chrono::milliseconds timeout, uint64_t budget) :
+        deadline(Clock::now() + timeout),
+        hasDeadline(timeout.count() > 0),
+        budget(budget),
+        used(0),
+        exceeded(0) {}
+
+    bool Active() const { return hasDeadline || budget; }
+
+    // Records 'units' of work and notes, without throwing, when that goes
+    // over a limit.
+    void Spend(uint64_t units) noexcept
+    {
+        if(!Active())
+            return;
+
+        uint64_t before = used.fetch_add(units);
+        uint64_t after  = before + units;
+        if(budget && after > budget)
+            Exceeded(QueryAborted::BUDGET);
+
+        // Looking at the clock every CLOCK_INTERVAL units is plenty.
+        if(hasDeadline && (after / CLOCK_INTERVAL != before / CLOCK_INTERVAL) && Clock::now() > deadline)
+            Exceeded(QueryAborted::DEADLINE);
+    }
+
+    // Throws QueryAborted for the first limit that was exceeded, if any.
+    void Check() const
+    {
+        int reason = exceeded.load();
+        if(reason)
+            throw QueryAborted(static_cast<QueryAborted::Reason>(reason - 1));
+    }
+
+    // Spend() and Check() in one, where throwing is safe.
+    void Charge(uint64_t units)
+    {
+        Spend(units);
+        Check();
+    }
+
+    uint64_t Used() const { return used.load(); }
+
+private:
+    static const uint64_t CLOCK_INTERVAL = 256;
+
+    void Exceeded(QueryAborted::Reason reason) noexcept
+    {
+        int none = 0;
+        exceeded.compare_exchange_strong(none, reason + 1);
+    }
+
+    Clock::time_point     deadline;
+    bool                  hasDeadline;
+    uint64_t              budget;
+    std::atomic<uint64_t> used;
+    std::atomic<int>      exceeded;     // the Reason plus one, 0 for none
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// -----------------------------------------------------------------------------
+// Serialized query results together with their ETags, each remembered with
+// the version of the document it was computed from. A lookup only hits when
+// the caller's current version matches, so stale entries are simply never
+// returned and get replaced by the next insert for the same key.
+//
+// Find() only reads the table and may run concurrently with other Find()
+// calls, e.g. under a shared lock; Insert() and SetCapacity() need exclusive
+// access.
+// -----------------------------------------------------------------------------
+
+class ResultCache
+{
+public:
+    explicit ResultCache(size_t capacity = 1024) : capacity(capacity), hits(0), misses(0) {}
+
+    // A capacity of zero disables the cache.
+    void SetCapacity(size_t count)
+    {
+        capacity = count;
+        entries.clear();
+    }
+
+    bool Find(const std::string &key, uint64_t version, std::string &body, std::string &etag) const
+    {
+        auto entry = entries.find(key);
+        if(entry == entries.end() || entry->second.version != version)
+        {
+            ++misses;
+            return false;
+        }
+        ++hits;
+        body = entry->second.body;
+        etag = entry->second.etag;
+        return true;
+    }
+
+    void Insert(const std::string &key, uint64_t version, const std::string &body, const std::string &etag)
+    {
+        if(!capacity)
+            return;
+
+        // When full, make room by dropping the entry computed longest ago;
+        // it is the most likely to be stale.
+        if(entries.size() >= capacity && !entries.count(key))
+        {
+            auto oldest = entries.begin();
+            for(auto entry = entries.begin(); entry != entries.end(); ++entry)
+                if(entry->second.version < oldest->second.version)
+                    oldest = entry;
+            entries.erase(oldest);
+        }
+
+        Entry &entry  = entries[key];
+        entry.version = version;
+        entry.body    = body;
+        entry.etag    = etag;
+    }
+
+    size_t Size() const     { return entries.size(); }
+    size_t Capacity() const { return capacity; }
+    size_t Hits() const     { return hits; }
+    size_t Misses() const   { return misses; }
+
+private:
+    struct Entry
+    {
+        uint64_t    version = 0;
+        std::string body;
+        std::string etag;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    size_t capacity;
+    mutable std::atomic<size_t> hits;
+    mutable std::atomic<size_t> misses;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// -----------------------------------------------------------------------------
+// A size-class heap. Small blocks are carved out of 64 KiB slabs and recycled
+// through one free list per size class; anything larger than the biggest class
+// goes straight to malloc. Every block carries an 8 byte header in front of
+// the payload so it can be released without knowing its size, and knows the
+// heap it came from: slabs are aligned to their size and start with a pointer
+// to their heap, and large blocks keep one in front of their header.
+//
+// A SlabHeap is not thread safe, except for DeallocateRemote(): a heap is
+// meant to be used by one thread at a time, and blocks it handed out that are
+// released on another thread are passed back with DeallocateRemote(). They
+// are queued under a lock of their own and put back on the free lists by the
+// next Allocate() on the owning thread.
+// -----------------------------------------------------------------------------
+
+class SlabHeap
+{
+public:
+    // Header kinds. Other allocators may tag their own blocks with values
+    // outside this range and use BlockKind() to tell them apart.
+    static const uint32_t SMALL_BLOCK = 1;
+    static const uint32_t LARGE_BLOCK = 2;
+
+    static const size_t HEADER_SIZE = 8;
+    static const size_t SLAB_SIZE   = 64 * 1024;
+    static const size_t MAX_SMALL   = 4096;
+
+    SlabHeap();
+    ~SlabHeap();
+
+    SlabHeap(const SlabHeap &) = delete;
+    SlabHeap &operator=(const SlabHeap &) = delete;
+
+    void  *Allocate(size_t size);
+    void  *Reallocate(void *ptr, size_t newSize);
+    void   Deallocate(void *ptr);
+
+    // Queues a block of this heap for release by its owning thread. May be
+    // called from any thread.
+    void   DeallocateRemote(void *ptr);
+
+    // Usable payload bytes of a block handed out by this heap.
+    size_t BlockSize(const void *ptr) const;
+
+    size_t BytesInUse() const   { return inUse; }
+    size_t BytesReserved() const { return reserved; }
+
+    static uint32_t BlockKind(const void *ptr);
+
+    // The heap a SMALL_BLOCK or LARGE_BLOCK came from.
+    static SlabHeap *OwnerOf(const void *ptr);
+
+private:
+    struct Header
+    {
+        uint32_t kind;
+        uint32_t cls;
+    };
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    struct Slab
+    {
+        Slab     *next;
+        SlabHeap *owner;
+    };
+
+    static size_t ClassOf(size_t size);
+    static size_t ClassSize(size_t cls);
+
+    void Refill(size_t cls);
+    void DrainRemote();
+
+    FreeBlock **freeLists;
+    Slab       *slabs;
+    size_t      inUse;
+    size_t      reserved;
+
+    // Blocks released on other threads, linked through their payloads.
+    std::mutex          remoteMutex;
+    std::atomic<void*>  remoteFrees;
+};
+
+// -----------------------------------------------------------------------------
+// RapidJSON allocator backed by a process wide SlabHeap. Unlike
+// MemoryPoolAllocator it sets kNeedFree, so memory released by RemoveMember,
+// Erase, Swap and assignment goes back on the free lists and is reused.
+// All instances share the same heap; like the rest of the document it must
+// only be touched while holding the document lock.
+// -----------------------------------------------------------------------------
+
+class SlabAllocator
+{
+public:
+    static const bool kNeedFree = true;
+
+    void *Malloc(size_t size);
+    void *Realloc(void *originalPtr, size_t originalSize, size_t newSize);
+    static void Free(void *ptr);
+
+    static size_t Size();
+    static size_t Capacity();
+
+    bool operator==(const SlabAllocator &) const { return true; }
+    bool operator!=(const SlabAllocator &) const { return false; }
+};
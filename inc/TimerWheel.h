@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// A hierarchical timer wheel: Levels wheels of 256 slots each, where a slot
+// of level k spans 256^k ticks. A timer goes into the lowest level whose
+// span reaches its deadline and moves down a level each time the clock
+// enters its slot, so advancing the clock costs the slots it passes plus
+// the timers that come due, whatever the number of timers pending.
+//
+// Timers are never looked up: to cancel or reschedule one, the owner keeps
+// the deadline it last scheduled for each key and ignores entries that come
+// due with a different one. Deadlines are absolute ticks and those past the
+// reach of the top level wait in an overflow list.
+//
+// Not thread safe.
+// -----------------------------------------------------------------------------
+
+template <class Key, size_t Levels = 4>
+class TimerWheel
+{
+public:
+    typedef std::pair<Key, uint64_t> Entry;     // key and deadline
+
+    explicit TimerWheel(uint64_t now = 0) : current(now), pending(0) {}
+
+    // Schedules 'key' for 'deadline'. A deadline that has already passed
+    // comes due on the next Advance().
+    void Schedule(const Key &key, uint64_t deadline)
+    {
+        ++pending;
+        Place(Entry(key, deadline));
+    }
+
+    // Moves the clock to 'now' and queues the timers that came due.
+    void Advance(uint64_t now)
+    {
+        // Nothing to pass on the way; skip the idle slots.
+        if(pending == due.size())
+        {
+            if(now > current)
+                current = now;
+            return;
+        }
+
+        while(current < now)
+        {
+            ++current;
+
+            // Top down, so what a level hands down is refiled in time.
+            for(size_t level = Levels + 1; level-- > 0; )
+            {
+                if((current & Mask(level)) == 0)
+                    Cascade(level);
+            }
+        }
+    }
+
+    // Takes up to 'limit' of the queued timers into 'expired', oldest first.
+    // Returns whether more are queued.
+    bool TakeDue(std::vector<Entry> &expired, size_t limit)
+    {
+        for(; limit && !due.empty(); --limit)
+        {
+            expired.push_back(std::move(due.front()));
+            due.pop_front();
+            --pending;
+        }
+        return !due.empty();
+    }
+
+    // Timers scheduled and not yet taken, cancelled ones included.
+    size_t Size() const { return pending; }
+
+    uint64_t Now() const { return current; }
+
+private:
+    static const unsigned kBits  = 8;
+    static const size_t   kSlots = size_t(1) << kBits;
+
+    static uint64_t Mask(size_t level)
+    {
+        return level * kBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << (level * kBits)) - 1;
+    }
+
+    // Files 'entry' in the lowest level where the deadline and the clock
+    // share all the higher digits, at the slot of the deadline's digit.
+    void Place(Entry entry)
+    {
+        uint64_t deadline = entry.second;
+        if(deadline <= current)
+        {
+            due.push_back(std::move(entry));
+            return;
+        }
+
+        for(size_t level = 0; level < Levels; ++level)
+        {
+            if((deadline & ~Mask(level + 1)) == (current & ~Mask(level + 1)))
+            {
+                size_t slot = (deadline >> (level * kBits)) & (kSlots - 1);
+                wheels[level][slot].push_back(std::move(entry));
+                return;
+            }
+        }
+        overflow.push_back(std::move(entry));
+    }
+
+    // Refiles the slot of 'level' the clock just entered; for level 0 that
+    // means queueing its timers as due. Level Levels is the overflow list.
+    void Cascade(size_t level)
+    {
+        std::vector<Entry> entries;
+        if(level == Levels)
+            entries.swap(overflow);
+        else
+            entries.swap(wheels[level][(current >> (level * kBits)) & (kSlots - 1)]);
+
+        for(Entry &entry : entries)
+            Place(std::move(entry));
+    }
+
+    std::vector<Entry> wheels[Levels][kSlots];
+    std::vector<Entry> overflow;
+    std::deque<Entry>  due;
+    uint64_t           current;
+    size_t             pending;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// A fixed set of threads that run numbered tasks for a caller. Run() hands out
+// task numbers to the workers and to the calling thread itself, and returns
+// once every task has finished. One Run() at a time; calls are serialized.
+//
+// Tasks also get the slot of the thread running them: 0 for the caller and
+// 1 ... Size() for the workers, so per-thread state can be kept in an array.
+// -----------------------------------------------------------------------------
+
+class WorkerPool
+{
+public:
+    explicit WorkerPool(size_t threads = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Stops the current workers and starts 'threads' new ones.
+    void Resize(size_t threads);
+
+    // Number of worker threads, not counting the caller of Run().
+    size_t Size() const { return workers.size(); }
+
+    typedef std::function<void(size_t task, size_t slot)> Task;
+
+    // Calls task(0, slot) ... task(count - 1, slot), spread over the workers
+    // and the calling thread. The first exception thrown by a task is
+    // rethrown here after all tasks are done.
+    void Run(size_t count, const Task &task);
+
+private:
+    void Work(size_t slot);
+    void Drain(size_t slot);
+    void Stop();
+
+    std::vector<std::thread> workers;
+
+    std::mutex              runMutex;       // one Run() at a time
+    std::mutex              mutex;          // guards the job fields below
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const Task             *task;
+    size_t                  count;
+    size_t                  next;
+    size_t                  finished;
+    unsigned long           generation;
+    bool                    stopping;
+    std::exception_ptr      failure;
+};
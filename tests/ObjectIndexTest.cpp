@@ -0,0 +1,224 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ObjectIndex.h"
+
+// -----------------------------------------------------------------------------
+// Checks that lookups through ObjectIndex find what a linear FindMember finds
+// while its wrappers add, remove and erase members, when member arrays are
+// reallocated, reordered or hold duplicate names, and when a table no longer
+// matches the names in its member array.
+// -----------------------------------------------------------------------------
+
+typedef rapidjson::Value Value;
+
+static int failures = 0;
+
+// -----------------------------------------------------------------------------
+
+Value MakeObject(const std::vector<std::string> &names, rapidjson::Document::AllocatorType &allocator)
+{
+    Value object(rapidjson::kObjectType);
+    int number = 0;
+    for(const std::string &name : names)
+        object.AddMember(Value(name.c_str(), allocator), Value(number++), allocator);
+    return object;
+}
+
+// -----------------------------------------------------------------------------
+
+// Every name of 'object' and one it doesn't have must be found where a
+// linear scan finds them.
+void ExpectConsistent(ObjectIndex<Value> &index, Value &object, const std::string &what)
+{
+    for(auto m = object.MemberBegin(); m != object.MemberEnd(); ++m)
+    {
+        auto found = index.FindMember(object, m->name);
+        if(found != object.FindMember(m->name))
+        {
+            std::cerr << "FAIL: " << what << ": member " << m->name.GetString() << " found at the wrong place" << std::endl;
+            ++failures;
+        }
+    }
+
+    if(index.FindMember(object, "missing", 7) != object.MemberEnd())
+    {
+        std::cerr << "FAIL: " << what << ": found a member that isn't there" << std::endl;
+        ++failures;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void ExpectOrder(const Value &object, const std::vector<std::string> &names, const std::string &what)
+{
+    std::vector<std::string> actual;
+    for(auto m = object.MemberBegin(); m != object.MemberEnd(); ++m)
+        actual.push_back(m->name.GetString());
+    if(actual != names)
+    {
+        std::cerr << "FAIL: " << what << ": members out of order" << std::endl;
+        ++failures;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckThreshold(rapidjson::Document::AllocatorType &allocator)
+{
+    ObjectIndex<Value> index;
+    index.SetThreshold(4);
+
+    Value small = MakeObject({"a", "b", "c"}, allocator);
+    ExpectConsistent(index, small, "below the threshold");
+    if(!index.Empty())
+    {
+        std::cerr << "FAIL: an object below the threshold got a table" << std::endl;
+        ++failures;
+    }
+
+    Value large = MakeObject({"a", "b", "c", "d"}, allocator);
+    ExpectConsistent(index, large, "at the threshold");
+    if(index.Size() != 1)
+    {
+        std::cerr << "FAIL: an object at the threshold has no table" << std::endl;
+        ++failures;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckRemoveAndErase(rapidjson::Document::AllocatorType &allocator)
+{
+    ObjectIndex<Value> index;
+    index.SetThreshold(2);
+
+    // RemoveMember moves the last member into the hole, EraseMember shifts
+    // the ones after it down; the table follows either way.
+    Value removed = MakeObject({"a", "b", "c", "d", "e"}, allocator);
+    ExpectConsistent(index, removed, "before RemoveMember");
+    index.RemoveMember(removed, index.FindMember(removed, "b", 1));
+    ExpectOrder(removed, {"a", "e", "c", "d"}, "RemoveMember");
+    ExpectConsistent(index, removed, "after RemoveMember");
+
+    Value erased = MakeObject({"a", "b", "c", "d", "e"}, allocator);
+    ExpectConsistent(index, erased, "before EraseMember");
+    index.EraseMember(erased, index.FindMember(erased, "b", 1));
+    ExpectOrder(erased, {"a", "c", "d", "e"}, "EraseMember");
+    ExpectConsistent(index, erased, "after EraseMember");
+
+    index.EraseMember(erased, index.FindMember(erased, "e", 1));
+    ExpectOrder(erased, {"a", "c", "d"}, "EraseMember of the last member");
+    ExpectConsistent(index, erased, "after EraseMember of the last member");
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckAdd(rapidjson::Document::AllocatorType &allocator)
+{
+    ObjectIndex<Value> index;
+    index.SetThreshold(2);
+
+    // Enough members to reallocate the member array a few times.
+    Value object = MakeObject({"a", "b"}, allocator);
+    for(int i = 0; i < 100; ++i)
+    {
+        ExpectConsistent(index, object, "while adding");
+        Value name(("m" + std::to_string(i)).c_str(), allocator);
+        Value value(i);
+        index.AddMember(object, name, value, allocator);
+    }
+    ExpectConsistent(index, object, "after adding");
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckDuplicates(rapidjson::Document::AllocatorType &allocator)
+{
+    ObjectIndex<Value> index;
+    index.SetThreshold(2);
+
+    Value object = MakeObject({"a", "b", "a", "c"}, allocator);
+    auto first = index.FindMember(object, "a", 1);
+    if(first != object.MemberBegin())
+    {
+        std::cerr << "FAIL: duplicate names should find the first member" << std::endl;
+        ++failures;
+    }
+
+    index.RemoveMember(object, first);
+    ExpectOrder(object, {"c", "b", "a"}, "RemoveMember of a duplicate");
+    ExpectConsistent(index, object, "after RemoveMember of a duplicate");
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckStaleTables(rapidjson::Document::AllocatorType &allocator)
+{
+    ObjectIndex<Value> index;
+    index.SetThreshold(2);
+
+    // Members renamed in place stand for a member array that another object
+    // got after its table was left behind: the hits are checked. The names
+    // are too long to be stored inline, so the old keys stay readable.
+    const std::string a = "a member name stored out of line";
+    const std::string b = "b member name stored out of line";
+    Value object = MakeObject({a, b, "c"}, allocator);
+    ExpectConsistent(index, object, "before renaming");
+    object.MemberBegin()[0].name.SetString(b.c_str(), allocator);
+    object.MemberBegin()[1].name.SetString(a.c_str(), allocator);
+    ExpectConsistent(index, object, "after renaming");
+
+    // Members swapped in place keep the member array; Reordered() drops
+    // its table.
+    Value reordered = MakeObject({"a", "b", "c"}, allocator);
+    ExpectConsistent(index, reordered, "before reordering");
+    reordered.MemberBegin()[0].name.Swap(reordered.MemberBegin()[2].name);
+    reordered.MemberBegin()[0].value.Swap(reordered.MemberBegin()[2].value);
+    index.Reordered(reordered);
+    ExpectOrder(reordered, {"c", "b", "a"}, "reordering");
+    ExpectConsistent(index, reordered, "after reordering");
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckForget(rapidjson::Document::AllocatorType &allocator)
+{
+    ObjectIndex<Value> index;
+    index.SetThreshold(2);
+
+    Value outer = MakeObject({"a", "b"}, allocator);
+    Value inner = MakeObject({"x", "y"}, allocator);
+    outer.MemberBegin()[0].value = inner;
+    ExpectConsistent(index, outer, "outer");
+    ExpectConsistent(index, outer.MemberBegin()[0].value, "inner");
+    if(index.Size() != 2)
+    {
+        std::cerr << "FAIL: expected a table for each object" << std::endl;
+        ++failures;
+    }
+
+    index.Forget(outer);
+    if(!index.Empty())
+    {
+        std::cerr << "FAIL: Forget should drop the tables of a value and of those below it" << std::endl;
+        ++failures;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    rapidjson::Document document;
+    rapidjson::Document::AllocatorType &allocator = document.GetAllocator();
+
+    CheckThreshold(allocator);
+    CheckRemoveAndErase(allocator);
+    CheckAdd(allocator);
+    CheckDuplicates(allocator);
+    CheckStaleTables(allocator);
+    CheckForget(allocator);
+    return failures ? 1 : 0;
+}
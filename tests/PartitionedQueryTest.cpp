@@ -0,0 +1,169 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <jsoncons/json.hpp>
+#include <jsoncons_ext/jsonpointer/jsonpointer.hpp>
+#include <jsoncons_ext/jsonpath/jsonpath.hpp>
+#include <jsoncons_ext/jmespath/jmespath.hpp>
+
+#include "PartitionedQuery.h"
+
+// -----------------------------------------------------------------------------
+// Checks that SplitElementwiseQuery only lets through queries whose result
+// over an array is the concatenation of their results over its elements: for
+// each query it accepts, the partitioned result over any number of parts, on
+// the worker pool or not, must dump exactly as the result of evaluating the
+// query over the whole array.
+// -----------------------------------------------------------------------------
+
+typedef jsoncons::json Json;
+
+static int failures = 0;
+
+// -----------------------------------------------------------------------------
+
+Json Evaluate(const std::string &query, const Json &node)
+{
+    if(query.at(0) == '$')
+        return jsoncons::jsonpath::make_expression<Json>(query).evaluate(node);
+    return jsoncons::jmespath::make_expression<Json>(query).evaluate(node);
+}
+
+// -----------------------------------------------------------------------------
+
+Json MakeDocument(size_t count)
+{
+    Json items(jsoncons::json_array_arg);
+    for(size_t i = 0; i < count; ++i)
+    {
+        Json item(jsoncons::json_object_arg);
+        item["id"]   = i;
+        item["name"] = "item" + std::to_string(i);
+        item["kind"] = i % 3 == 0 ? "a|b" : "c";
+
+        Json nested(jsoncons::json_object_arg);
+        nested["group"] = i % 4;
+        item["nested"] = nested;
+
+        Json tags(jsoncons::json_array_arg);
+        for(size_t t = 0; t < i % 3; ++t)
+            tags.push_back("t" + std::to_string(t));
+        item["tags"] = tags;
+        items.push_back(item);
+    }
+
+    Json document(jsoncons::json_object_arg);
+    document["items"] = items;
+    return document;
+}
+
+// -----------------------------------------------------------------------------
+
+void ExpectSplit(const std::string &query, bool expected)
+{
+    std::vector<std::string> prefix;
+    std::string elementwise;
+    if(SplitElementwiseQuery(query, prefix, elementwise) != expected)
+    {
+        std::cerr << "FAIL: " << query << (expected ? " should" : " should not") << " be element-wise" << std::endl;
+        ++failures;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void ExpectSameResult(const std::string &query, const Json &document, WorkerPool &pool)
+{
+    std::vector<std::string> prefix;
+    std::string elementwise;
+    if(!SplitElementwiseQuery(query, prefix, elementwise))
+    {
+        std::cerr << "FAIL: " << query << " should be element-wise" << std::endl;
+        ++failures;
+        return;
+    }
+
+    const Json *array = &document;
+    for(const std::string &name : prefix)
+        array = &array->at(name);
+
+    std::string expected;
+    Evaluate(query, document).dump(expected);
+
+    for(size_t parts = 1; parts <= 7; ++parts)
+    {
+        for(WorkerPool *on : { (WorkerPool *)0, &pool })
+        {
+            auto evaluate = [&](size_t begin, size_t end, size_t) -> Json
+            {
+                Json slice = SliceOf(*array, begin, end);
+                return Evaluate(elementwise, slice);
+            };
+
+            Json result;
+            std::string actual;
+            if(EvaluateInParts(*array, parts, on, evaluate, result))
+                result.dump(actual);
+            if(actual != expected)
+            {
+                std::cerr << "FAIL: " << query << " in " << parts << " parts" << (on ? " on the pool" : "")
+                          << " gave " << actual << ", expected " << expected << std::endl;
+                ++failures;
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    WorkerPool pool(3);
+    Json document = MakeDocument(50);
+    const Json &items = document["items"];
+
+    const char *jsonpath[] =
+    {
+        "$.items[*]",
+        "$.items[*].id",
+        "$['items'][?(@.id > 10)].name",
+        "$.items.*.nested.group",
+        "$.items[*].tags[*]",
+        "$.items[?(@.nested.group == 1)]"
+    };
+    for(const char *query : jsonpath)
+        ExpectSameResult(query, document, pool);
+
+    const char *jmespath[] =
+    {
+        "[*].id",
+        "[?id > `10`].name",
+        "[*].nested.group",
+        "[*].tags[0]",
+        "[?nested.group == `1`].{n: name, g: nested.group}",
+        "[?kind == 'a|b'].id"
+    };
+    for(const char *query : jmespath)
+        ExpectSameResult(query, items, pool);
+
+    const char *rejected[] =
+    {
+        "[*].id || name",
+        "[?id > `1`].name && kind",
+        "[*].id == `1`",
+        "[*].id < `3`",
+        "[*].id != `3`",
+        "[*].id | [0]",
+        "[*].tags[]",
+        "items[*].id",
+        "$.items[?(@.id == $.items[0].id)]",
+        "$..id"
+    };
+    for(const char *query : rejected)
+        ExpectSplit(query, false);
+
+    if(failures)
+        std::cerr << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
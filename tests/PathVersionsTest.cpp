@@ -0,0 +1,121 @@
+#include <iostream>
+#include <string>
+
+#include "PathVersions.h"
+
+// -----------------------------------------------------------------------------
+// Checks the versions the ETags are made of: a write changes the version of
+// the written path, of its ancestors and of everything below it, and leaves
+// those of its siblings and their subtrees alone, also when the table
+// collapses past its limit (which only makes more paths look changed).
+// -----------------------------------------------------------------------------
+
+typedef PathVersions::Path Path;
+
+static int failures = 0;
+
+// -----------------------------------------------------------------------------
+
+std::string Show(const Path &path)
+{
+    std::string shown;
+    for(const std::string &token : path)
+        shown += "/" + token;
+    return shown.empty() ? "(root)" : shown;
+}
+
+// -----------------------------------------------------------------------------
+
+void ExpectVersion(const PathVersions &versions, const Path &path, uint64_t expected)
+{
+    uint64_t version = versions.Version(path);
+    if(version != expected)
+    {
+        std::cerr << "FAIL: " << Show(path) << " is at version " << version << ", expected " << expected << std::endl;
+        ++failures;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckWrites()
+{
+    PathVersions versions;
+    ExpectVersion(versions, {"a"}, 0);
+
+    uint64_t ab = versions.Touch({"a", "b"});
+    ExpectVersion(versions, {}, ab);
+    ExpectVersion(versions, {"a"}, ab);
+    ExpectVersion(versions, {"a", "b"}, ab);
+    ExpectVersion(versions, {"a", "b", "c", "d"}, ab);
+    ExpectVersion(versions, {"a", "x"}, 0);
+
+    uint64_t ax = versions.Touch({"a", "x"});
+    ExpectVersion(versions, {"a"}, ax);
+    ExpectVersion(versions, {"a", "x"}, ax);
+    ExpectVersion(versions, {"a", "b"}, ab);
+    ExpectVersion(versions, {"a", "b", "c"}, ab);
+
+    // A write deep below keeps the stamp of the write above it for the
+    // rest of that subtree.
+    uint64_t abc = versions.Touch({"a", "b", "c"});
+    ExpectVersion(versions, {"a", "b"}, abc);
+    ExpectVersion(versions, {"a", "b", "c"}, abc);
+    ExpectVersion(versions, {"a", "b", "d"}, ab);
+
+    // A write above supersedes the stamps below it.
+    uint64_t a = versions.Touch({"a"});
+    ExpectVersion(versions, {"a", "b", "d"}, a);
+    ExpectVersion(versions, {"a", "x"}, a);
+    if(versions.Size() != 2)
+    {
+        std::cerr << "FAIL: the stamps below a write should be dropped, " << versions.Size() << " left" << std::endl;
+        ++failures;
+    }
+
+    // Names that only share a prefix are not below one another.
+    uint64_t ab2 = versions.Touch({"ab"});
+    ExpectVersion(versions, {"a"}, a);
+    ExpectVersion(versions, {"ab"}, ab2);
+    if(versions.Current() != ab2)
+    {
+        std::cerr << "FAIL: the current version should be the last write's" << std::endl;
+        ++failures;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckLimit()
+{
+    PathVersions versions(4);
+    uint64_t first = versions.Touch({"first"});
+    versions.Touch({"other", "0"});
+    uint64_t collapsed = versions.Touch({"other", "1"});
+    if(versions.Size() > 4)
+    {
+        std::cerr << "FAIL: the table grew past its limit" << std::endl;
+        ++failures;
+    }
+
+    // Collapsed into one stamp at the root: every path has moved on.
+    if(versions.Version({"first"}) <= first)
+    {
+        std::cerr << "FAIL: a collapsed table should make every path look changed" << std::endl;
+        ++failures;
+    }
+    ExpectVersion(versions, {"other", "0"}, collapsed);
+
+    uint64_t after = versions.Touch({"after"});
+    ExpectVersion(versions, {"after"}, after);
+    ExpectVersion(versions, {"first"}, collapsed);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    CheckWrites();
+    CheckLimit();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,3 @@
+# Starts the scripted tests from an empty document without TTLs.
+file(WRITE "${DATAFILE}" "{}")
+file(REMOVE "${DATAFILE}.ttl")
@@ -0,0 +1,317 @@
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fcgio.h"
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+// -----------------------------------------------------------------------------
+// Serves holdmybeer the requests of the script named by HOLDMYBEER_SCRIPT and
+// checks its answers. The script is a list of blocks separated by lines
+// holding "%%". Lines starting with '#' before a block's request are
+// comments. A block is either
+//
+//   SLEEP <seconds>
+//
+// or a request line, a body and an optional expectation:
+//
+//   METHOD PATH [NAME=VALUE ...]      (PATH '' is the empty path)
+//   <body lines>
+//   => STATUS [JSON]
+//
+// where the NAME=VALUE pairs are FastCGI parameters, CONTENT_TYPE defaulting
+// to application/json. The answer must have STATUS and, when JSON is given,
+// a body that serializes as it does, member order included. The process
+// exits with 1 once the daemon has saved its document if any check failed.
+// -----------------------------------------------------------------------------
+
+struct Block
+{
+    std::string request;
+    std::string body;
+    std::string expectedBody;
+    int         expectedStatus = 0;
+    double      sleep = 0;
+};
+
+static std::vector<Block> script;
+static size_t next    = 0;
+static bool   loaded  = false;
+static int    checks  = 0;
+static int    failures = 0;
+
+// -----------------------------------------------------------------------------
+
+fcgi_streambuf::int_type fcgi_streambuf::overflow(int_type c)
+{
+    if(c != traits_type::eof())
+        stream->data.push_back(traits_type::to_char_type(c));
+    return c;
+}
+
+// -----------------------------------------------------------------------------
+
+std::streamsize fcgi_streambuf::xsputn(const char *s, std::streamsize n)
+{
+    stream->data.append(s, n);
+    return n;
+}
+
+// -----------------------------------------------------------------------------
+
+fcgi_streambuf::int_type fcgi_streambuf::underflow()
+{
+    if(stream->position >= stream->data.size())
+        return traits_type::eof();
+
+    char *begin = &stream->data[0];
+    setg(begin, begin + stream->position, begin + stream->data.size());
+    stream->position = stream->data.size();
+    return traits_type::to_int_type(*gptr());
+}
+
+// -----------------------------------------------------------------------------
+
+static void Report()
+{
+    if(!failures)
+        return;
+    fprintf(stderr, "%d of %d checks failed\n", failures, checks);
+    fflush(stderr);
+    _exit(1);
+}
+
+// -----------------------------------------------------------------------------
+
+static void Fail(const Block &block, const std::string &why)
+{
+    fprintf(stderr, "FAIL: %s: %s\n", block.request.c_str(), why.c_str());
+    ++failures;
+}
+
+// -----------------------------------------------------------------------------
+
+static bool StartsWith(const std::string &text, const char *prefix)
+{
+    return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// -----------------------------------------------------------------------------
+
+static void AddBlock(const std::vector<std::string> &lines)
+{
+    size_t line = 0;
+    while(line < lines.size() && (lines[line].empty() || lines[line][0] == '#'))
+        ++line;
+    if(line == lines.size())
+        return;
+
+    Block block;
+    if(StartsWith(lines[line], "SLEEP "))
+    {
+        block.sleep = atof(lines[line].c_str() + 6);
+        script.push_back(block);
+        return;
+    }
+
+    block.request = lines[line++];
+    for(size_t first = line; line < lines.size() && !StartsWith(lines[line], "=>"); ++line)
+        block.body += (line == first ? "" : "\n") + lines[line];
+
+    if(line < lines.size())
+    {
+        std::istringstream expectation(lines[line].substr(2));
+        expectation >> block.expectedStatus;
+        std::getline(expectation, block.expectedBody);
+        for(++line; line < lines.size(); ++line)
+            block.expectedBody += "\n" + lines[line];
+    }
+    script.push_back(block);
+}
+
+// -----------------------------------------------------------------------------
+
+static void LoadScript()
+{
+    loaded = true;
+    atexit(Report);
+
+    const char *name = getenv("HOLDMYBEER_SCRIPT");
+    std::ifstream in(name ? name : "");
+    if(!in.is_open())
+    {
+        fprintf(stderr, "FAIL: cannot read the script '%s'\n", name ? name : "");
+        ++failures;
+        return;
+    }
+
+    std::vector<std::string> lines;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        if(line == "%%")
+        {
+            AddBlock(lines);
+            lines.clear();
+        }
+        else
+            lines.push_back(line);
+    }
+    AddBlock(lines);
+}
+
+// -----------------------------------------------------------------------------
+
+// The compact serialization of 'text', or 'text' itself if it isn't JSON.
+static std::string Normalize(const std::string &text)
+{
+    rapidjson::Document parsed;
+    parsed.Parse(text.c_str());
+    if(parsed.HasParseError())
+        return text;
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    parsed.Accept(writer);
+    return buffer.GetString();
+}
+
+// -----------------------------------------------------------------------------
+
+static void Check(const Block &block, const std::string &answer, const std::string &errors)
+{
+    ++checks;
+
+    size_t end = answer.find("\r\n\r\n");
+    std::string headers = answer.substr(0, end);
+    std::string body = end == std::string::npos ? "" : answer.substr(end + 4);
+
+    int status = 200;
+    size_t header = ("\r\n" + headers).find("\r\nStatus: ");
+    if(header != std::string::npos)
+        status = atoi(headers.c_str() + header + 8);
+
+    if(status != block.expectedStatus)
+        Fail(block, "status " + std::to_string(status) + ", expected " + std::to_string(block.expectedStatus));
+    else if(block.expectedBody.find_first_not_of(" \n") != std::string::npos
+         && Normalize(body) != Normalize(block.expectedBody))
+        Fail(block, "answered " + Normalize(body) + ", expected " + Normalize(block.expectedBody));
+    else
+        return;
+
+    if(!errors.empty())
+        fprintf(stderr, "      logged: %s\n", errors.c_str());
+}
+
+// -----------------------------------------------------------------------------
+
+extern "C"
+{
+
+char *FCGX_GetParam(const char *name, FCGX_ParamArray envp)
+{
+    size_t length = strlen(name);
+    for(char **e = envp; e && *e; ++e)
+    {
+        if(!strncmp(*e, name, length) && (*e)[length] == '=')
+            return *e + length + 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+int FCGX_Init(void)
+{
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+int FCGX_OpenSocket(const char *, int)
+{
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+int FCGX_InitRequest(FCGX_Request *request, int, int)
+{
+    request->in   = new FCGX_Stream;
+    request->out  = new FCGX_Stream;
+    request->err  = new FCGX_Stream;
+    request->envp = 0;
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+int FCGX_Accept_r(FCGX_Request *request)
+{
+    if(!loaded)
+        LoadScript();
+
+    for(; next < script.size() && !script[next].request.size(); ++next)
+        usleep((useconds_t)(script[next].sleep * 1e6));
+    if(next == script.size())
+        return -1;
+
+    const Block &block = script[next];
+    std::istringstream line(block.request);
+    std::string method, path, parameter;
+    line >> method >> path;
+    if(path == "''")
+        path.clear();
+
+    std::vector<std::string> parameters = { "REQUEST_METHOD=" + method, "PATH_INFO=" + path, "REMOTE_ADDR=127.0.0.1" };
+    bool typed = false;
+    while(line >> parameter)
+    {
+        typed = typed || StartsWith(parameter, "CONTENT_TYPE=");
+        parameters.push_back(parameter);
+    }
+    if(!typed)
+        parameters.push_back("CONTENT_TYPE=application/json");
+
+    if(request->envp)
+    {
+        for(char **e = request->envp; *e; ++e)
+            free(*e);
+        delete[] request->envp;
+    }
+    request->envp = new char*[parameters.size() + 1];
+    for(size_t i = 0; i < parameters.size(); ++i)
+        request->envp[i] = strdup(parameters[i].c_str());
+    request->envp[parameters.size()] = 0;
+
+    *request->in  = FCGX_Stream();
+    *request->out = FCGX_Stream();
+    *request->err = FCGX_Stream();
+    request->in->data = block.body;
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+void FCGX_Finish_r(FCGX_Request *request)
+{
+    const Block &block = script[next++];
+    if(block.expectedStatus)
+        Check(block, request->out->data, request->err->data);
+}
+
+// -----------------------------------------------------------------------------
+
+void FCGX_ShutdownPending(void)
+{
+}
+
+}
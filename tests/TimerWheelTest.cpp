@@ -0,0 +1,143 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "TimerWheel.h"
+
+// -----------------------------------------------------------------------------
+// Checks that TimerWheel hands out every timer once, in the Advance() that
+// reaches its deadline and not before, whether it starts in the lowest
+// wheel, cascades down from a higher one or waits in the overflow list, and
+// that the owner's cancel-by-deadline pattern the daemon uses for TTLs only
+// expires the latest schedule of a key.
+// -----------------------------------------------------------------------------
+
+typedef TimerWheel<std::string, 2> Wheel;       // two levels reach 65536 ticks
+
+static int failures = 0;
+
+// -----------------------------------------------------------------------------
+
+std::vector<Wheel::Entry> TakeAll(Wheel &wheel)
+{
+    std::vector<Wheel::Entry> expired;
+    while(wheel.TakeDue(expired, 2))
+        ;
+    return expired;
+}
+
+// -----------------------------------------------------------------------------
+
+void ExpectDue(Wheel &wheel, uint64_t now, const std::vector<std::string> &keys)
+{
+    wheel.Advance(now);
+    std::vector<Wheel::Entry> expired = TakeAll(wheel);
+
+    bool same = expired.size() == keys.size();
+    for(size_t i = 0; same && i < keys.size(); ++i)
+        same = expired[i].first == keys[i];
+    if(!same)
+    {
+        std::cerr << "FAIL: at " << now << " expected " << keys.size() << " timers due, got";
+        for(const Wheel::Entry &entry : expired)
+            std::cerr << " " << entry.first << "@" << entry.second;
+        std::cerr << std::endl;
+        ++failures;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void ExpectSize(const Wheel &wheel, size_t size)
+{
+    if(wheel.Size() != size)
+    {
+        std::cerr << "FAIL: " << wheel.Size() << " timers pending, expected " << size << std::endl;
+        ++failures;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckLevels()
+{
+    Wheel wheel(1000);
+    wheel.Schedule("soon", 1005);
+    wheel.Schedule("cascaded", 1000 + 300);     // next slot of level 1
+    wheel.Schedule("far", 1000 + 70000);        // past both levels
+    wheel.Schedule("past", 10);
+    ExpectSize(wheel, 4);
+
+    ExpectDue(wheel, 1000, {"past"});
+    ExpectDue(wheel, 1004, {});
+    ExpectDue(wheel, 1005, {"soon"});
+    ExpectDue(wheel, 1299, {});
+    ExpectDue(wheel, 1300, {"cascaded"});
+    ExpectDue(wheel, 1000 + 69999, {});
+    ExpectDue(wheel, 1000 + 70000, {"far"});
+    ExpectSize(wheel, 0);
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckLargeSteps()
+{
+    // One Advance() over many slots still hands out everything it passed,
+    // oldest first, and what is due stays queued until taken.
+    Wheel wheel(0);
+    wheel.Schedule("b", 512);
+    wheel.Schedule("a", 3);
+    wheel.Schedule("c", 66000);
+    wheel.Advance(100000);
+
+    std::vector<Wheel::Entry> expired;
+    if(!wheel.TakeDue(expired, 1) || expired.size() != 1 || expired[0].first != "a")
+    {
+        std::cerr << "FAIL: TakeDue should hand out the oldest timer first and report more queued" << std::endl;
+        ++failures;
+    }
+    ExpectSize(wheel, 2);
+    ExpectDue(wheel, 100000, {"b", "c"});
+    ExpectDue(wheel, 200000, {});
+}
+
+// -----------------------------------------------------------------------------
+
+void CheckRescheduled()
+{
+    // A rescheduled key has two entries; the owner ignores the one whose
+    // deadline is no longer the key's.
+    Wheel wheel(0);
+    uint64_t deadline = 10;
+    wheel.Schedule("key", deadline);
+    deadline = 20;
+    wheel.Schedule("key", deadline);
+    ExpectSize(wheel, 2);
+
+    wheel.Advance(10);
+    std::vector<Wheel::Entry> expired = TakeAll(wheel);
+    if(expired.size() != 1 || expired[0].second == deadline)
+    {
+        std::cerr << "FAIL: the stale schedule should come due alone at 10" << std::endl;
+        ++failures;
+    }
+
+    wheel.Advance(20);
+    expired = TakeAll(wheel);
+    if(expired.size() != 1 || expired[0].second != deadline)
+    {
+        std::cerr << "FAIL: the current schedule should come due at 20" << std::endl;
+        ++failures;
+    }
+    ExpectSize(wheel, 0);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    CheckLevels();
+    CheckLargeSteps();
+    CheckRescheduled();
+    return failures ? 1 : 0;
+}
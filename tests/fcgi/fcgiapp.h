@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+
+// -----------------------------------------------------------------------------
+// Stand-in for libfcgi's fcgiapp.h, declaring the part of it holdmybeer uses.
+// The scripted tests link holdmybeer.cpp against ScriptedFcgi.cpp, which
+// serves requests read from a script instead of a socket.
+// -----------------------------------------------------------------------------
+
+typedef struct FCGX_Stream
+{
+    std::string data;
+    size_t      position = 0;
+} FCGX_Stream;
+
+typedef char **FCGX_ParamArray;
+
+typedef struct FCGX_Request
+{
+    FCGX_Stream     *in;
+    FCGX_Stream     *out;
+    FCGX_Stream     *err;
+    FCGX_ParamArray  envp;
+} FCGX_Request;
+
+extern "C"
+{
+    char *FCGX_GetParam(const char *name, FCGX_ParamArray envp);
+    int   FCGX_Init(void);
+    int   FCGX_OpenSocket(const char *path, int backlog);
+    int   FCGX_InitRequest(FCGX_Request *request, int sock, int flags);
+    int   FCGX_Accept_r(FCGX_Request *request);
+    void  FCGX_Finish_r(FCGX_Request *request);
+    void  FCGX_ShutdownPending(void);
+}
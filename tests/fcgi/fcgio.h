@@ -0,0 +1,23 @@
+#pragma once
+
+#include <streambuf>
+
+#include "fcgiapp.h"
+
+// -----------------------------------------------------------------------------
+// Stand-in for libfcgi++'s fcgio.h: a streambuf over a scripted FCGX_Stream.
+// -----------------------------------------------------------------------------
+
+class fcgi_streambuf : public std::streambuf
+{
+public:
+    explicit fcgi_streambuf(FCGX_Stream *stream) : stream(stream) {}
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+    int_type underflow() override;
+
+private:
+    FCGX_Stream *stream;
+};